@@ -0,0 +1,97 @@
+/*
+ * This file is part of the ezoom plugin and is distributed under the
+ * same terms as ezoom.cpp.
+ *
+ * Packs cursor images from XFixes into the layout of the cursor cache
+ * texture.
+ */
+
+#ifndef _EZOOM_CURSORPACK_H
+#define _EZOOM_CURSORPACK_H
+
+#include <stdint.h>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* XFixes hands out cursor pixels as longs holding ARGB, which are 64
+ * bit on most machines. Keep the low 32 bits of each.  */
+static inline void
+packCursorRowC (const unsigned long *in, uint32_t *out, int n)
+{
+    for (int i = 0; i < n; i++)
+	out[i] = in[i];
+}
+
+static inline void
+packCursorRow (const unsigned long *in, uint32_t *out, int n)
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    if (sizeof (unsigned long) == 8)
+    {
+	/* Four longs in, four pixels out: the even dwords */
+	for (; i + 4 <= n; i += 4)
+	{
+	    __m128i a = _mm_loadu_si128 ((const __m128i *) (in + i));
+	    __m128i b = _mm_loadu_si128 ((const __m128i *) (in + i + 2));
+
+	    a = _mm_shuffle_epi32 (a, _MM_SHUFFLE (3, 1, 2, 0));
+	    b = _mm_shuffle_epi32 (b, _MM_SHUFFLE (3, 1, 2, 0));
+	    _mm_storeu_si128 ((__m128i *) (out + i),
+			      _mm_unpacklo_epi64 (a, b));
+	}
+    }
+#endif
+
+    packCursorRowC (in + i, out + i, n - i);
+}
+
+/* Fill out with the width by height image in pixels, inside a
+ * transparent border of one pixel. XFixes through Xlib has longs,
+ * through xcb 32 bit words.  */
+static inline void
+clearCursorBorder (uint32_t *out, int width, int height)
+{
+    int stride = width + 2;
+
+    memset (out, 0, stride * sizeof (uint32_t));
+    memset (out + (height + 1) * stride, 0, stride * sizeof (uint32_t));
+
+    for (int y = 1; y <= height; y++)
+    {
+	out[y * stride] = 0;
+	out[y * stride + width + 1] = 0;
+    }
+}
+
+static inline void
+packCursorImage (const unsigned long *pixels,
+		 int		     width,
+		 int		     height,
+		 uint32_t	     *out)
+{
+    clearCursorBorder (out, width, height);
+
+    for (int y = 0; y < height; y++)
+	packCursorRow (pixels + y * width, out + (y + 1) * (width + 2) + 1,
+		       width);
+}
+
+static inline void
+copyCursorImage (const uint32_t *pixels,
+		 int		width,
+		 int		height,
+		 uint32_t	*out)
+{
+    clearCursorBorder (out, width, height);
+
+    for (int y = 0; y < height; y++)
+	memcpy (out + (y + 1) * (width + 2) + 1, pixels + y * width,
+		width * sizeof (uint32_t));
+}
+
+#endif
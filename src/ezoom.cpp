@@ -73,6 +73,7 @@
  */
 
 #include "ezoom.h"
+#include "cursorpack.h"
 
 COMPIZ_PLUGIN_20090315 (ezoom, ZoomPluginVTable)
 
@@ -90,6 +91,21 @@ toggleFunctions (bool state)
     zs->cScreen->preparePaintSetEnabled (zs, state);
     zs->gScreen->glPaintOutputSetEnabled (zs, state);
     zs->cScreen->donePaintSetEnabled (zs, state);
+    zs->cScreen->damageRegionSetEnabled (zs, state);
+
+    foreach (CompWindow *w, screen->windows ())
+    {
+	EZoomWindow *zw = EZoomWindow::get (w);
+
+	zw->gWindow->glPaintSetEnabled (zw, state);
+	zw->gWindow->glDrawTextureSetEnabled (zw, state);
+    }
+
+    /* Damage was not tracked while we were off */
+    for (unsigned int out = 0; out < zs->zooms.size (); out++)
+	zs->zooms[out].sceneCached = false;
+
+    zs->functionsEnabled = state;
 }
 
 /* Check if the output is valid */
@@ -178,16 +194,18 @@ EZoomScreen::ZoomArea::updateActualTranslates ()
 bool
 EZoomScreen::isInMovement (int out)
 {
-    if (zooms.at (out).currentZoom == 1.0f &&
-	zooms.at (out).newZoom == 1.0f &&
-	zooms.at (out).zVelocity == 0.0f)
+    ZoomArea &za = zooms[out];
+
+    if (za.currentZoom == 1.0f &&
+	za.newZoom == 1.0f &&
+	za.zVelocity == 0.0f)
 	return false;
-    if (zooms.at (out).currentZoom != zooms.at (out).newZoom ||
-	zooms.at (out).xVelocity || zooms.at (out).yVelocity ||
-	zooms.at (out).zVelocity)
+    if (za.currentZoom != za.newZoom ||
+	za.xVelocity || za.yVelocity ||
+	za.zVelocity)
 	return true;
-    if (zooms.at (out).xTranslate != zooms.at (out).realXTranslate ||
-	zooms.at (out).yTranslate != zooms.at (out).realYTranslate)
+    if (za.xTranslate != za.realXTranslate ||
+	za.yTranslate != za.realYTranslate)
 	return true;
     return false;
 }
@@ -205,7 +223,19 @@ EZoomScreen::ZoomArea::ZoomArea (int out) :
     yTranslate (0.0f),
     realXTranslate (0.0f),
     realYTranslate (0.0f),
-    locked (false)
+    locked (false),
+    startZoom (1.0f),
+    startXTranslate (0.0f),
+    startYTranslate (0.0f),
+    targetZoom (1.0f),
+    targetXTranslate (0.0f),
+    targetYTranslate (0.0f),
+    elapsed (0.0f),
+    queued (false),
+    paintedZoom (0.0f),
+    paintedXTrans (0.0f),
+    paintedYTrans (0.0f),
+    sceneCached (false)
 {
     updateActualTranslates ();
 }
@@ -221,158 +251,728 @@ EZoomScreen::ZoomArea::ZoomArea () :
     yTranslate (0.0f),
     realXTranslate (0.0f),
     realYTranslate (0.0f),
-    locked (false)
+    locked (false),
+    startZoom (1.0f),
+    startXTranslate (0.0f),
+    startYTranslate (0.0f),
+    targetZoom (1.0f),
+    targetXTranslate (0.0f),
+    targetYTranslate (0.0f),
+    elapsed (0.0f),
+    queued (false),
+    paintedZoom (0.0f),
+    paintedXTrans (0.0f),
+    paintedYTrans (0.0f),
+    sceneCached (false)
+{
+}
+
+/* True if something moved the target since the motion started */
+bool
+EZoomScreen::ZoomArea::targetChanged ()
+{
+    return (newZoom != targetZoom ||
+	    xTranslate != targetXTranslate ||
+	    yTranslate != targetYTranslate);
+}
+
+/* Start a new motion from where we are now towards the current target */
+void
+EZoomScreen::ZoomArea::startMotion ()
+{
+    startZoom = currentZoom;
+    startXTranslate = realXTranslate;
+    startYTranslate = realYTranslate;
+    targetZoom = newZoom;
+    targetXTranslate = xTranslate;
+    targetYTranslate = yTranslate;
+    elapsed = 0.0f;
+}
+
+/* True if the view moved since it was last painted */
+bool
+EZoomScreen::ZoomArea::viewChanged ()
+{
+    return (currentZoom != paintedZoom ||
+	    xtrans != paintedXTrans ||
+	    ytrans != paintedYTrans);
+}
+
+void
+EZoomScreen::ZoomArea::viewPainted ()
+{
+    paintedZoom = currentZoom;
+    paintedXTrans = xtrans;
+    paintedYTrans = ytrans;
+}
+
+/* Jump straight to the target and stop */
+void
+EZoomScreen::ZoomArea::finishMotion ()
+{
+    currentZoom = newZoom;
+    realXTranslate = xTranslate;
+    realYTranslate = yTranslate;
+    xVelocity = 0.0f;
+    yVelocity = 0.0f;
+    zVelocity = 0.0f;
+}
+/* Structure-of-arrays copy of the animated values. Each output on the
+ * worklist gets three lanes: zoom, x and y.  */
+void
+EZoomScreen::MotionLanes::resize (unsigned int n)
+{
+    position.resize (n);
+    velocity.resize (n);
+    target.resize (n);
+    start.resize (n);
+    decay.resize (n);
+    dt.resize (n);
+    elapsed.resize (n);
+    count = n;
+}
+
+void
+EZoomScreen::MotionLanes::set (unsigned int i,
+			       GLfloat      p,
+			       GLfloat      v,
+			       GLfloat      t,
+			       GLfloat      s,
+			       GLfloat      d,
+			       float        ms,
+			       float        e)
+{
+    position[i] = p;
+    velocity[i] = v;
+    target[i] = t;
+    start[i] = s;
+    decay[i] = d;
+    dt[i] = ms;
+    elapsed[i] = e;
+}
+
+/* The original spring, see advanceSpring. Zoom lanes have a decay of 1,
+ * translation lanes 0.8 as the original divided their velocity by 1.25
+ * before each step.  */
+static void
+stepSpringLanes (EZoomScreen::MotionLanes &l, int steps, double h)
+{
+    advanceSprings (&l.position[0], &l.velocity[0], &l.target[0],
+		    &l.decay[0], l.count, steps, h, l.spring);
+}
+
+/* Critically damped spring, in closed form so it does not matter how
+ * the time is sliced up.  */
+static void
+stepCriticalLanes (EZoomScreen::MotionLanes &l, float omega)
+{
+    GLfloat *p = &l.position[0];
+    GLfloat *v = &l.velocity[0];
+    GLfloat *t = &l.target[0];
+    float   *dt = &l.dt[0];
+
+    for (unsigned int i = 0; i < l.count; i++)
+    {
+	float e = p[i] - t[i];
+	float c = v[i] + omega * e;
+	float decay = expf (-omega * dt[i]);
+
+	p[i] = t[i] + (e + c * dt[i]) * decay;
+	v[i] = (v[i] - omega * c * dt[i]) * decay;
+    }
+}
+
+/* Cubic ease-out from start to target over duration ms */
+static void
+stepEaseOutLanes (EZoomScreen::MotionLanes &l, float duration)
+{
+    GLfloat *p = &l.position[0];
+    GLfloat *v = &l.velocity[0];
+    GLfloat *t = &l.target[0];
+    GLfloat *s = &l.start[0];
+    float   *e = &l.elapsed[0];
+
+    for (unsigned int i = 0; i < l.count; i++)
+    {
+	float f = 1.0f - MIN (e[i] / duration, 1.0f);
+
+	p[i] = s[i] + (t[i] - s[i]) * (1.0f - f * f * f);
+	v[i] = 0.0f;
+    }
+}
+
+static void
+stepInstantLanes (EZoomScreen::MotionLanes &l)
+{
+    for (unsigned int i = 0; i < l.count; i++)
+    {
+	l.position[i] = l.target[i];
+	l.velocity[i] = 0.0f;
+    }
+}
+
+/* How far, in device pixels of the output, the view still has to move
+ * before it reaches the target. A displayed pixel at offset u from the
+ * center of the output shows source u * zoom + trans * size, so the
+ * worst case is at the edge of the output.  */
+float
+EZoomScreen::residualMotion (int out)
+{
+    CompOutput *o = &screen->outputDevs ()[out];
+    ZoomArea   &za = zooms[out];
+    float      zoom = MIN (za.currentZoom, za.newZoom);
+    float      dz = fabs (za.newZoom - za.currentZoom);
+    float      dx, dy;
+
+    dx = fabs (za.xTranslate * (1.0f - za.newZoom) -
+	       za.realXTranslate * (1.0f - za.currentZoom));
+    dy = fabs (za.yTranslate * (1.0f - za.newZoom) -
+	       za.realYTranslate * (1.0f - za.currentZoom));
+
+    return MAX (o->width () * (dz / 2.0f + dx),
+		o->height () * (dz / 2.0f + dy)) / zoom;
+}
+
+/* Put the output on the motion worklist so preparePaint animates it.
+ * Anything that changes newZoom or [xy]Translate must call this.  */
+void
+EZoomScreen::markMoving (int out)
+{
+    ZoomArea &za = zooms[out];
+
+    if (za.queued)
+	return;
+
+    za.queued = true;
+    moving.push_back (out);
+}
+
+/* Long jumps.
+ *
+ * With u the position along the line between the two centers and w the
+ * width of the view, the path of van Wijk and Nuij that is shortest in
+ * perceived motion is
+ *
+ *   u (s) = w0 / rho^2 * (cosh (r0) * tanh (rho * s + r0) - sinh (r0))
+ *   w (s) = w0 * cosh (r0) / cosh (rho * s + r0)
+ *
+ * for s from 0 to the path length S = (r1 - r0) / rho. rho trades zooming
+ * against panning, sqrt (2) is what their user study preferred.
+ */
+#define FLIGHT_RHO 1.42
+
+EZoomScreen::ZoomFlight::ZoomFlight () :
+    active (false),
+    duration (0.0f),
+    length (0.0)
 {
 }
-/* Adjust the velocity in the z-direction.  */
+
 void
-EZoomScreen::adjustZoomVelocity (int out, float chunk)
+EZoomScreen::ZoomFlight::plan (double fromX, double fromY, double fromW,
+			       double toX, double toY, double toW)
 {
-    float d, adjust, amount;
+    double rho2 = FLIGHT_RHO * FLIGHT_RHO;
 
-    d = (zooms.at (out).newZoom - zooms.at (out).currentZoom) * 75.0f;
+    x0 = fromX;
+    y0 = fromY;
+    w0 = fromW;
+    w1 = toW;
+    distance = sqrt ((toX - fromX) * (toX - fromX) +
+		     (toY - fromY) * (toY - fromY));
 
-    adjust = d * 0.002f;
-    amount = fabs (d);
-    if (amount < 1.0f)
-	amount = 1.0f;
-    else if (amount > 5.0f)
-	amount = 5.0f;
+    if (distance < 1.0)
+    {
+	/* Pure zoom */
+	dirX = dirY = 0.0;
+	r0 = 0.0;
+	length = fabs (log (w1 / w0)) / FLIGHT_RHO;
+    }
+    else
+    {
+	double b0, b1, r1;
+
+	dirX = (toX - fromX) / distance;
+	dirY = (toY - fromY) / distance;
+
+	b0 = (w1 * w1 - w0 * w0 + rho2 * rho2 * distance * distance) /
+	     (2.0 * w0 * rho2 * distance);
+	b1 = (w1 * w1 - w0 * w0 - rho2 * rho2 * distance * distance) /
+	     (2.0 * w1 * rho2 * distance);
+	r0 = log (-b0 + sqrt (b0 * b0 + 1.0));
+	r1 = log (-b1 + sqrt (b1 * b1 + 1.0));
+	length = (r1 - r0) / FLIGHT_RHO;
+    }
+}
 
-    zooms.at (out).zVelocity =
-	(amount * zooms.at (out).zVelocity + adjust) / (amount + 1.0f);
+/* Where the path is at t, from 0 to 1 */
+void
+EZoomScreen::ZoomFlight::evaluate (float t, double &x, double &y, double &w)
+{
+    double s = length * t;
+    double u;
 
-    if (fabs (d) < 0.1f && fabs (zooms.at (out).zVelocity) < 0.005f)
+    if (distance < 1.0)
     {
-	zooms.at (out).currentZoom = zooms.at (out).newZoom;
-	zooms.at (out).zVelocity = 0.0f;
+	u = 0.0;
+	w = w0 * exp ((w1 > w0 ? 1.0 : -1.0) * FLIGHT_RHO * s);
     }
     else
     {
-	zooms.at (out).currentZoom += (zooms.at (out).zVelocity * chunk) /
-	    cScreen->redrawTime ();
+	double rho2 = FLIGHT_RHO * FLIGHT_RHO;
+
+	u = w0 / rho2 * (cosh (r0) * tanh (FLIGHT_RHO * s + r0) - sinh (r0));
+	w = w0 * cosh (r0) / cosh (FLIGHT_RHO * s + r0);
     }
+
+    x = x0 + dirX * u;
+    y = y0 + dirY * u;
 }
 
-/* Adjust the X/Y velocity based on target translation and real
- * translation. */
+/* Plan a flight for the output if its new target is out of sight.
+ * Views are converted to a center and width in output pixels; the
+ * center of the view is at (0.5 + translate * (1 - zoom)) * size.
+ * Call after setting the target.  */
 void
-EZoomScreen::adjustXYVelocity (int out, float chunk)
+EZoomScreen::planFlight (int out)
 {
-    float xdiff, ydiff;
-    float xadjust, yadjust;
-    float xamount, yamount;
+    CompOutput *o = &screen->outputDevs ()[out];
+    ZoomArea   &za = zooms[out];
+    int        w = o->width (), h = o->height ();
+    double     fromX, fromY, fromW, toX, toY, toW;
+
+    za.flight.active = false;
+
+    if (!optionGetSmoothLongJumps () || za.locked)
+	return;
 
-    zooms.at (out).xVelocity /= 1.25f;
-    zooms.at (out).yVelocity /= 1.25f;
-    xdiff =
-	(zooms.at (out).xTranslate - zooms.at (out).realXTranslate) *
-	75.0f;
-    ydiff =
-	(zooms.at (out).yTranslate - zooms.at (out).realYTranslate) *
-	75.0f;
-    xadjust = xdiff * 0.002f;
-    yadjust = ydiff * 0.002f;
-    xamount = fabs (xdiff);
-    yamount = fabs (ydiff);
+    fromX = w * (0.5 + za.realXTranslate * (1.0 - za.currentZoom));
+    fromY = h * (0.5 + za.realYTranslate * (1.0 - za.currentZoom));
+    fromW = w * za.currentZoom;
+    toX = w * (0.5 + za.xTranslate * (1.0 - za.newZoom));
+    toY = h * (0.5 + za.yTranslate * (1.0 - za.newZoom));
+    toW = w * za.newZoom;
 
-    if (xamount < 1.0f)
-	    xamount = 1.0f;
-    else if (xamount > 5.0)
-	    xamount = 5.0f;
+    /* Still in sight, the motion profile does fine */
+    if (fabs (toX - fromX) <= fromW / 2.0 &&
+	fabs (toY - fromY) <= za.currentZoom * h / 2.0)
+	return;
 
-    if (yamount < 1.0f)
-	    yamount = 1.0f;
-    else if (yamount > 5.0)
-	    yamount = 5.0f;
+    za.flight.plan (fromX, fromY, fromW, toX, toY, toW);
+    za.flight.duration = MIN ((float) optionGetLongJumpMaxTime (),
+			      za.flight.length * 1000.0f /
+			      optionGetLongJumpSpeed ());
+    za.flight.toZoom = za.newZoom;
+    za.flight.toXTranslate = za.xTranslate;
+    za.flight.toYTranslate = za.yTranslate;
+    za.flight.active = true;
+    za.startMotion ();
+
+    markMoving (out);
+}
 
-    zooms.at (out).xVelocity =
-	(xamount * zooms.at (out).xVelocity + xadjust) / (xamount + 1.0f);
-    zooms.at (out).yVelocity =
-	(yamount * zooms.at (out).yVelocity + yadjust) / (yamount + 1.0f);
+/* Put the zoom area where the flight is after za.elapsed ms */
+void
+EZoomScreen::followFlight (int out)
+{
+    CompOutput *o = &screen->outputDevs ()[out];
+    ZoomArea   &za = zooms[out];
+    double     x, y, w;
+    float      zoom;
 
-    if ((fabs(xdiff) < 0.1f && fabs (zooms.at (out).xVelocity) < 0.005f) &&
-	(fabs(ydiff) < 0.1f && fabs (zooms.at (out).yVelocity) < 0.005f))
+    if (za.elapsed >= za.flight.duration)
     {
-	zooms.at (out).realXTranslate = zooms.at (out).xTranslate;
-	zooms.at (out).realYTranslate = zooms.at (out).yTranslate;
-	zooms.at (out).xVelocity = 0.0f;
-	zooms.at (out).yVelocity = 0.0f;
+	za.flight.active = false;
+	za.finishMotion ();
 	return;
     }
 
-    zooms.at (out).realXTranslate +=
-	(zooms.at (out).xVelocity * chunk) / cScreen->redrawTime ();
-    zooms.at (out).realYTranslate +=
-	(zooms.at (out).yVelocity * chunk) / cScreen->redrawTime ();
+    za.flight.evaluate (za.elapsed / za.flight.duration, x, y, w);
+
+    zoom = MAX (MIN (w / o->width (), 1.0), optionGetMinimumZoom ());
+    za.currentZoom = zoom;
+    za.xVelocity = za.yVelocity = za.zVelocity = 0.0f;
+
+    /* Fully zoomed out, the translation does not show */
+    if (zoom >= 1.0f)
+	return;
+
+    za.realXTranslate = (x / o->width () - 0.5) / (1.0 - zoom);
+    za.realYTranslate = (y / o->height () - 0.5) / (1.0 - zoom);
+    za.realXTranslate = MAX (MIN (za.realXTranslate, 0.5f), -0.5f);
+    za.realYTranslate = MAX (MIN (za.realYTranslate, 0.5f), -0.5f);
 }
 
-/* Animate the movement (if any) in preparation of a paint screen.  */
+/* Move every zoom area on the worklist ms milliseconds further
+ * according to the selected motion profile, interval being the frame
+ * interval the spring is relative to. Motion ends once less than half a
+ * pixel of it is left, and for every profile but the spring after
+ * motion_duration ms. Long jumps follow their flight instead and get no lanes.
+ *
+ * Only outputs on the worklist are touched, so the cost scales with
+ * the number of heads actually moving rather than with the number of
+ * heads.  */
 void
-EZoomScreen::preparePaint (int	   msSinceLastPaint)
+EZoomScreen::animateZoomAreas (float ms, float interval)
 {
-    if (grabbed)
+    float        duration = optionGetMotionDuration ();
+    int          profile = optionGetMotionProfile ();
+    float        springMs = 0.0f, amount, chunk;
+    int          steps;
+    unsigned int i, k;
+
+    /* Drop whatever stopped moving or was ungrabbed since */
+    for (i = 0; i < moving.size (); )
+    {
+	ZoomArea &za = zooms[moving[i]];
+
+	if ((grabbed & (1 << za.output)) && isInMovement (moving[i]))
+	{
+	    i++;
+	    continue;
+	}
+
+	za.queued = false;
+	moving[i] = moving.back ();
+	moving.pop_back ();
+    }
+
+    if (moving.empty () || ms <= 0.0f)
+	return;
+
+    lanes.resize (moving.size () * 3);
+
+    for (i = 0, k = 0; i < moving.size (); i++)
+    {
+	ZoomArea &za = zooms[moving[i]];
+	float    dt = ms;
+
+	/* msSinceLastPaint can be huge after we have been idle, don't
+	 * let that eat up the first frame of a new motion (or flight) */
+	if (za.targetChanged ())
+	{
+	    za.startMotion ();
+
+	    if (za.flight.active &&
+		(za.flight.toZoom != za.newZoom ||
+		 za.flight.toXTranslate != za.xTranslate ||
+		 za.flight.toYTranslate != za.yTranslate))
+		za.flight.active = false;
+	}
+
+	if (za.elapsed == 0.0f)
+	    dt = MIN (dt, interval);
+
+	za.elapsed += dt;
+
+	/* followFlight places it */
+	if (za.flight.active)
+	    continue;
+
+	springMs = MAX (springMs, dt);
+
+	lanes.set (k * 3, za.currentZoom, za.zVelocity, za.newZoom,
+		   za.startZoom, 1.0f, dt, za.elapsed);
+	lanes.set (k * 3 + 1, za.realXTranslate, za.xVelocity, za.xTranslate,
+		   za.startXTranslate, 0.8f, dt, za.elapsed);
+	lanes.set (k * 3 + 2, za.realYTranslate, za.yVelocity, za.yTranslate,
+		   za.startYTranslate, 0.8f, dt, za.elapsed);
+	k++;
+    }
+
+    lanes.count = k * 3;
+
+    /* The spring takes its steps from the clamped time too. Areas only
+     * start moving together after idling, so the longest is right */
+    amount = springMs * 0.05f * optionGetSpeed ();
+    steps = amount / (0.5f * optionGetTimestep ());
+    if (!steps)
+	steps = 1;
+    chunk = amount / (float) steps;
+
+    switch (profile)
+    {
+	case EzoomOptions::MotionProfileSpring:
+	    stepSpringLanes (lanes, steps, chunk / interval);
+	    break;
+	case EzoomOptions::MotionProfileCriticallyDamped:
+	    /* Leaves (1 + 8) * e^-8, or 0.3%, of the distance at the
+	     * deadline */
+	    stepCriticalLanes (lanes, 8.0f / duration);
+	    break;
+	case EzoomOptions::MotionProfileEaseOut:
+	    stepEaseOutLanes (lanes, duration);
+	    break;
+	case EzoomOptions::MotionProfileInstant:
+	default:
+	    stepInstantLanes (lanes);
+	    break;
+    }
+
+    for (i = 0, k = 0; i < moving.size (); i++)
     {
-	int   steps;
-	float amount, chunk;
+	int      out = moving[i];
+	ZoomArea &za = zooms[out];
+
+	if (za.flight.active)
+	{
+	    followFlight (out);
+	}
+	else
+	{
+	    za.currentZoom = lanes.position[k * 3];
+	    za.zVelocity = lanes.velocity[k * 3];
+	    za.realXTranslate = lanes.position[k * 3 + 1];
+	    za.xVelocity = lanes.velocity[k * 3 + 1];
+	    za.realYTranslate = lanes.position[k * 3 + 2];
+	    za.yVelocity = lanes.velocity[k * 3 + 2];
+	    k++;
+	}
 
-	amount = msSinceLastPaint * 0.05f * optionGetSpeed ();
-	steps  = amount / (0.5f * optionGetTimestep ());
-	if (!steps)
-	       	steps = 1;
-	chunk  = amount / (float) steps;
-	while (steps--)
+	/* The thresholds the spring always used */
+	if (profile == EzoomOptions::MotionProfileSpring && !za.flight.active)
 	{
-	    unsigned int out;
-	    for (out = 0; out < zooms.size (); out++)
+	    if (fabs ((za.newZoom - za.currentZoom) * 75.0f) < 0.1f &&
+		fabs (za.zVelocity) < 0.005f)
 	    {
-		if (!isInMovement (out) || !isActive (out))
-		    continue;
+		za.currentZoom = za.newZoom;
+		za.zVelocity = 0.0f;
+	    }
 
-		adjustXYVelocity (out, chunk);
-		adjustZoomVelocity (out, chunk);
-		zooms.at (out).updateActualTranslates ();
-		if (!isZoomed (out))
-		{
-		    zooms.at (out).xVelocity = zooms.at (out).yVelocity =
-			0.0f;
-		    grabbed &= ~(1 << zooms.at (out).output);
-		    if (!grabbed)
-		    {
-			cScreen->damageScreen ();
-			toggleFunctions (false);
-		    }
-		}
+	    if ((fabs ((za.xTranslate - za.realXTranslate) * 75.0f) < 0.1f &&
+		 fabs (za.xVelocity) < 0.005f) &&
+		(fabs ((za.yTranslate - za.realYTranslate) * 75.0f) < 0.1f &&
+		 fabs (za.yVelocity) < 0.005f))
+	    {
+		za.realXTranslate = za.xTranslate;
+		za.realYTranslate = za.yTranslate;
+		za.xVelocity = 0.0f;
+		za.yVelocity = 0.0f;
+	    }
+	}
+
+	if ((za.elapsed >= duration && !za.flight.active &&
+	     profile != EzoomOptions::MotionProfileSpring) ||
+	    residualMotion (out) < 0.5f)
+	    za.finishMotion ();
+
+	za.updateActualTranslates ();
+
+	if (!isZoomed (out))
+	{
+	    za.xVelocity = za.yVelocity = 0.0f;
+	    grabbed &= ~(1 << za.output);
+	    if (!grabbed)
+	    {
+		damageView ();
+		toggleFunctions (false);
 	    }
 	}
-	if (optionGetZoomMode () == EzoomOptions::ZoomModeSyncMouse)
-	    syncCenterToMouse ();
+    }
+}
+
+static double
+monotonicMs ()
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* Predict when the frame we are about to paint reaches the screen: the
+ * first refresh after now, counted from the last frame that was shown.
+ * Returns how far that is from the moment the previous frame was
+ * animated for, so skipped refreshes are accounted for in one go and a
+ * second paint for the same refresh does not move anything.  */
+float
+EZoomScreen::nextPresentationDelta ()
+{
+    double now = monotonicMs ();
+    double predicted;
+    float  delta;
+
+    /* Nothing shown recently, the next refresh is about one interval
+     * away */
+    if (now - lastPresentation > 4.0 * refreshInterval)
+	predicted = now + refreshInterval;
+    else
+	predicted = lastPresentation + refreshInterval *
+		    MAX (1.0, ceil ((now - lastPresentation) / refreshInterval));
+
+    if (now - lastPredicted > 4.0 * refreshInterval)
+	delta = refreshInterval;
+    else
+	delta = MAX (0.0, predicted - lastPredicted);
+
+    lastPredicted = predicted;
+
+    return delta;
+}
+
+/* Move everything ms milliseconds further, interval being the frame
+ * interval the spring is relative to.  */
+void
+EZoomScreen::stepMotion (float ms, float interval)
+{
+    /* No time passed, but the worklist is still cleaned up */
+    if (ms > 0.0f)
+    {
+	continuousPan (ms);
+	edgePush (ms);
+    }
+    animateZoomAreas (ms, interval);
+
+    if (optionGetZoomMode () == EzoomOptions::ZoomModeSyncMouse)
+	syncCenterToMouse ();
+}
+
+/* Animate the movement (if any) in preparation of a paint screen.
+ * With remote panning the motion is stepped by remotePanTimeout
+ * instead.  */
+void
+EZoomScreen::preparePaint (int	   msSinceLastPaint)
+{
+    flushZoomInput ();
+    collectCursor ();
+    flushWarp ();
+
+    if (grabbed && !optionGetRemotePan ())
+    {
+	float ms = msSinceLastPaint;
+	float interval = cScreen->redrawTime ();
+
+	if (optionGetTimingMode () ==
+	    EzoomOptions::TimingModePresentationTime)
+	{
+	    ms = nextPresentationDelta ();
+	    interval = refreshInterval;
+	}
+
+	stepMotion (ms, interval);
     }
 
     cScreen->preparePaint (msSinceLastPaint);
 }
 
-/* Damage screen if we're still moving.  */
+/* Remote panning.
+ *
+ * Over a remote session every frame of a moving view is a new screen
+ * to encode and send. In remote pan mode the motion is stepped from a
+ * timer at no more than remote_pan_rate frames a second, paintedView
+ * keeps the view on whole output pixels. A frame in which the view only
+ * moved is drawn from the scene cache without painting any windows, and
+ * as it is resampled at the same whole pixel offsets it is an exact
+ * shift of the last one.
+ *
+ * It is still damaged as a whole. GL hands the server the damaged
+ * rectangles as new pixels, never as a copy, and damaging just the
+ * strips that scroll in would leave the shifted rest off the screen;
+ * moving it there means drawing into the front buffer behind the
+ * compositor's back. Whether the shift goes out as a move is up to the
+ * server's encoder.
+ */
+bool
+EZoomScreen::remotePanTimeout ()
+{
+    float  interval = 1000.0f / optionGetRemotePanRate ();
+    double now = monotonicMs ();
+    float  ms = now - lastRemoteStep;
+
+    /* Idle since the last step, see nextPresentationDelta */
+    if (ms > 4.0f * interval)
+	ms = interval;
+    lastRemoteStep = now;
+
+    if (!grabbed)
+	return false;
+
+    stepMotion (ms, interval);
+    damagePan ();
+
+    return false;
+}
+
+/* Damage the outputs the last remote pan step moved the view of */
+void
+EZoomScreen::damagePan ()
+{
+    CompRegion damage;
+
+    if (optionGetLensShape () != EzoomOptions::LensShapeOff)
+    {
+	damageLens ();
+	return;
+    }
+
+    for (unsigned int out = 0; out < zooms.size (); out++)
+	if (isActive (out) && zooms[out].viewChanged ())
+	    damage += screen->outputDevs ()[out];
+
+    if (damage.isEmpty ())
+	return;
+
+    damage += cursorRegion ();
+    if (grabIndex)
+	damage += boxRegion ();
+
+    damageZoomedRegion (damage);
+}
+
+/* Damage screen if we're still moving. Anything that stopped was
+ * dropped from the worklist in preparePaint.
+ *
+ * The buffer swap happened just before this, so this is also where the
+ * refresh interval is measured for the presentation time clock. Gaps
+ * from idling or dropped frames are not samples of it.  */
 void
 EZoomScreen::donePaint ()
 {
+    double now = monotonicMs ();
+    double sample = now - lastPresentation;
+
+    if (sample > refreshInterval * 0.25 && sample < refreshInterval * 1.5)
+	refreshInterval = refreshInterval * 0.9f + sample * 0.1f;
+    lastPresentation = now;
+
+    /* Anything from here on is for the next frame */
+    ownFullDamage = false;
+    mirrorDrawn = false;
+
     if (grabbed)
     {
-	unsigned int out;
-	for (out = 0; out < zooms.size (); out++)
+	bool stepping = !moving.empty () || panSpeed > 0.0f || edgePushing;
+	int  mode = optionGetZoomMode ();
+
+	/* With remote panning only the timer steps the motion, so it also
+	 * has to run whenever a step could start one: pan keys held, the
+	 * pointer near an edge or the view following it */
+	if (optionGetRemotePan ())
 	{
-	    if (isInMovement (out) && isActive (out))
-	    {
-		cScreen->damageScreen ();
-		break;
-	    }
+	    float interval = 1000.0f / optionGetRemotePanRate ();
+	    float left = interval - (now - lastRemoteStep);
+
+	    if ((stepping || panKeys ||
+		 mode == EzoomOptions::ZoomModeEdgePush ||
+		 mode == EzoomOptions::ZoomModeSyncMouse) &&
+		!remoteTimer.active ())
+		remoteTimer.start (MAX (left, 0.0f), MAX (left, 0.0f) + 5);
+	}
+	else if (stepping)
+	{
+	    if (optionGetLensShape () != EzoomOptions::LensShapeOff)
+		damageLens ();
+	    else
+		damageView ();
 	}
     }
-    else if (grabIndex)
-	cScreen->damageScreen ();
-    else
+    else if (!grabIndex) // the zoom box damages itself
         toggleFunctions (false);
 
+    /* Keep painting until collectCursor has the new cursor */
+    if (cursorPending)
+	damageZoomedRegion (cursorRegion ());
+
     cScreen->donePaint ();
 }
 /* Draws a box from the screen coordinates inx1,iny1 to inx2,iny2 */
@@ -408,12 +1008,1377 @@ EZoomScreen::drawBox (const GLMatrix &transform,
     glVertex2i (x1, y2);
     glEnd ();
     glColor4usv (defaultColor);
-    glDisable (GL_BLEND);
-    glEnableClientState (GL_TEXTURE_COORD_ARRAY);
+    glDisable (GL_BLEND);
+    glEnableClientState (GL_TEXTURE_COORD_ARRAY);
+    glPopMatrix ();
+}
+#define OVERLAY_STRIDE 9
+
+static const char *overlayProgram =
+    "!!ARBfp1.0\n"
+    "TEMP tex;\n"
+    "TEX tex, fragment.texcoord[0], texture[0], RECT;\n"
+    "LRP result.color, fragment.texcoord[0].z, tex, fragment.color;\n"
+    "END\n";
+
+EZoomScreen::OverlayRenderer::OverlayRenderer () :
+    tried (false),
+    buffer (0),
+    program (0),
+    capacity (0)
+{
+}
+
+/* Look up the buffer object entry points and build the program, once.
+ * Returns false if the driver lacks either.  */
+bool
+EZoomScreen::OverlayRenderer::init (GLScreen *gScreen)
+{
+    GLint errorPos;
+
+    if (tried)
+	return program != 0;
+
+    tried = true;
+
+    if (!GL::fragmentProgram)
+	return false;
+
+    genBuffers = (GenBuffersProc)
+	gScreen->getProcAddress ("glGenBuffersARB");
+    deleteBuffers = (DeleteBuffersProc)
+	gScreen->getProcAddress ("glDeleteBuffersARB");
+    bindBuffer = (BindBufferProc)
+	gScreen->getProcAddress ("glBindBufferARB");
+    bufferData = (BufferDataProc)
+	gScreen->getProcAddress ("glBufferDataARB");
+    bufferSubData = (BufferSubDataProc)
+	gScreen->getProcAddress ("glBufferSubDataARB");
+
+    if (!genBuffers || !deleteBuffers || !bindBuffer || !bufferData ||
+	!bufferSubData)
+	return false;
+
+    glGetError ();
+
+    (*GL::genPrograms) (1, &program);
+    (*GL::bindProgram) (GL_FRAGMENT_PROGRAM_ARB, program);
+    (*GL::programString) (GL_FRAGMENT_PROGRAM_ARB,
+			  GL_PROGRAM_FORMAT_ASCII_ARB,
+			  strlen (overlayProgram), overlayProgram);
+    glGetIntegerv (GL_PROGRAM_ERROR_POSITION_ARB, &errorPos);
+    (*GL::bindProgram) (GL_FRAGMENT_PROGRAM_ARB, 0);
+
+    if (glGetError () != GL_NO_ERROR || errorPos != -1)
+    {
+	compLogMessage ("ezoom", CompLogLevelWarn,
+			"failed to load overlay fragment program");
+	(*GL::deletePrograms) (1, &program);
+	program = 0;
+	return false;
+    }
+
+    (*genBuffers) (1, &buffer);
+
+    return true;
+}
+
+void
+EZoomScreen::OverlayRenderer::fini ()
+{
+    if (buffer)
+	(*deleteBuffers) (1, &buffer);
+    if (program)
+	(*GL::deletePrograms) (1, &program);
+
+    buffer = 0;
+    program = 0;
+    capacity = 0;
+    tried = false;
+}
+
+/* Queue a quad as two triangles. s and t are in pixels of the bound
+ * texture, for textured quads.  */
+void
+EZoomScreen::OverlayRenderer::addQuad (float x1, float y1,
+				       float x2, float y2,
+				       float s1, float t1,
+				       float s2, float t2,
+				       bool  textured,
+				       const GLushort color[4])
+{
+    const float corners[6][4] = {
+	{ x1, y1, s1, t1 }, { x1, y2, s1, t2 }, { x2, y2, s2, t2 },
+	{ x1, y1, s1, t1 }, { x2, y2, s2, t2 }, { x2, y1, s2, t1 }
+    };
+
+    for (int i = 0; i < 6; i++)
+    {
+	vertices.push_back (corners[i][0]);
+	vertices.push_back (corners[i][1]);
+	vertices.push_back (corners[i][2]);
+	vertices.push_back (corners[i][3]);
+	vertices.push_back (textured ? 1.0f : 0.0f);
+	for (int c = 0; c < 4; c++)
+	    vertices.push_back (color[c] / 65535.0f);
+    }
+}
+
+/* Upload the queued quads and draw them all at once, in screen space.
+ * The buffer is kept and only grown.  */
+void
+EZoomScreen::OverlayRenderer::draw (const GLMatrix &transform,
+				    GLuint	   texture)
+{
+    GLsizeiptrARB size = vertices.size () * sizeof (GLfloat);
+    GLsizei	  stride = OVERLAY_STRIDE * sizeof (GLfloat);
+    const GLfloat *base = NULL;
+
+    if (vertices.empty ())
+	return;
+
+    (*bindBuffer) (GL_ARRAY_BUFFER_ARB, buffer);
+    if (size > capacity)
+    {
+	(*bufferData) (GL_ARRAY_BUFFER_ARB, size, &vertices[0],
+		       GL_STREAM_DRAW_ARB);
+	capacity = size;
+    }
+    else
+    {
+	(*bufferSubData) (GL_ARRAY_BUFFER_ARB, 0, size, &vertices[0]);
+    }
+
+    glPushMatrix ();
+    glLoadMatrixf (transform.getMatrix ());
+
+    glVertexPointer (2, GL_FLOAT, stride, base);
+    glTexCoordPointer (3, GL_FLOAT, stride, base + 2);
+    glColorPointer (4, GL_FLOAT, stride, base + 5);
+    glEnableClientState (GL_COLOR_ARRAY);
+
+    glEnable (GL_BLEND);
+    glBindTexture (GL_TEXTURE_RECTANGLE_ARB, texture);
+    glEnable (GL_FRAGMENT_PROGRAM_ARB);
+    (*GL::bindProgram) (GL_FRAGMENT_PROGRAM_ARB, program);
+
+    glDrawArrays (GL_TRIANGLES, 0, vertices.size () / OVERLAY_STRIDE);
+
+    (*GL::bindProgram) (GL_FRAGMENT_PROGRAM_ARB, 0);
+    glDisable (GL_FRAGMENT_PROGRAM_ARB);
+    glBindTexture (GL_TEXTURE_RECTANGLE_ARB, 0);
+    glDisable (GL_BLEND);
+
+    /* The rest of compiz uses client side arrays */
+    glDisableClientState (GL_COLOR_ARRAY);
+    (*bindBuffer) (GL_ARRAY_BUFFER_ARB, 0);
+    glColor4usv (defaultColor);
+
+    glPopMatrix ();
+
+    vertices.clear ();
+}
+
+/* Draw the scaled cursor (on zoomed outputs) and the zoom box (while
+ * grabbed) over an output, in one go if the overlay renderer works, or
+ * else with drawCursor and drawBox.  */
+void
+EZoomScreen::drawOverlays (CompOutput     *output,
+			   const GLMatrix &transform)
+{
+    static const GLushort white[4] = { 0xffff, 0xffff, 0xffff, 0xffff };
+    static const GLushort fill[4] = { 0x2fff, 0x2fff, 0x4fff, 0x4fff };
+    static const GLushort line[4] = { 0x2fff, 0x2fff, 0x4fff, 0x9fff };
+    GLMatrix sTransform = transform;
+    int	     out = output->id ();
+    bool     withCursor = isActive (out) && cursor.isSet;
+    bool     withBox = grabIndex;
+
+    /* The mirror source is unzoomed and shows the real cursor; the
+     * scaled one and the box go on the target */
+    if (!drawingMirror && mirrorActive () && out == optionGetMirrorSource ())
+    {
+	withCursor = false;
+	withBox = false;
+    }
+
+    /* XXX: see drawCursor */
+    if (withCursor && screen->grabExist ("expo"))
+    {
+	cursorZoomInactive ();
+	withCursor = false;
+    }
+
+    if (!overlays.init (gScreen))
+    {
+	if (withCursor)
+	    drawCursor (output, transform);
+	if (withBox)
+	    drawBox (transform, output, box);
+	return;
+    }
+
+    if (withCursor)
+    {
+	float scale;
+	int   ax, ay;
+
+	if (optionGetScaleMouseDynamic ())
+	    scale = 1.0f / zooms[out].currentZoom;
+	else
+	    scale = 1.0f / optionGetScaleMouseStatic ();
+
+	convertToZoomed (out, mouse.x (), mouse.y (), &ax, &ay);
+	overlays.addQuad (ax - cursor.hotX * scale,
+			  ay - cursor.hotY * scale,
+			  ax + (cursor.width - cursor.hotX) * scale,
+			  ay + (cursor.height - cursor.hotY) * scale,
+			  cursor.x, cursor.y, cursor.x + cursor.width,
+			  cursor.y + cursor.height, true, white);
+    }
+
+    if (withBox)
+    {
+	int x1, y1, x2, y2;
+
+	convertToZoomed (out, box.x1 (), box.y1 (), &x1, &y1);
+	convertToZoomed (out, box.x2 (), box.y2 (), &x2, &y2);
+
+	if (x1 > x2)
+	    std::swap (x1, x2);
+	if (y1 > y2)
+	    std::swap (y1, y2);
+
+	/* The fill, then a one pixel outline on top */
+	overlays.addQuad (x1, y1, x2, y2, 0, 0, 0, 0, false, fill);
+	overlays.addQuad (x1, y1, x2, y1 + 1, 0, 0, 0, 0, false, line);
+	overlays.addQuad (x1, y2 - 1, x2, y2, 0, 0, 0, 0, false, line);
+	overlays.addQuad (x1, y1 + 1, x1 + 1, y2 - 1, 0, 0, 0, 0, false,
+			  line);
+	overlays.addQuad (x2 - 1, y1 + 1, x2, y2 - 1, 0, 0, 0, 0, false,
+			  line);
+    }
+
+    sTransform.toScreenSpace (output, -DEFAULT_Z_CAMERA);
+    overlays.draw (sTransform, withCursor ? cursor.texture : 0);
+}
+
+/* Where drawBox puts the box, outline included, on each output */
+CompRegion
+EZoomScreen::boxRegion ()
+{
+    CompRegion region;
+
+    for (unsigned int out = 0; out < zooms.size (); out++)
+    {
+	CompOutput *o = &screen->outputDevs ()[out];
+	int	   x1, y1, x2, y2;
+
+	convertToZoomed (out, box.x1 (), box.y1 (), &x1, &y1);
+	convertToZoomed (out, box.x2 (), box.y2 (), &x2, &y2);
+
+	CompRegion part = CompRegion (MIN (x1, x2) - 1, MIN (y1, y2) - 1,
+				      abs (x2 - x1) + 2, abs (y2 - y1) + 2).
+			  intersected (*o);
+
+	/* The mirror source's box is drawn on the target */
+	if (mirrorActive () && (int) out == optionGetMirrorSource ())
+	    part = mirrorRegion (part);
+	region += part;
+    }
+
+    return region;
+}
+
+/* Window damage is reported in unzoomed screen space, but on a zoomed
+ * output it shows up magnified somewhere else. Move it to where it is
+ * visible, clipped to the output, so only that gets repainted. It also
+ * marks that part of the scene cache stale.  */
+void
+EZoomScreen::damageRegion (const CompRegion &region)
+{
+    CompRegion   r (region);
+    unsigned int out;
+
+    if (damagingZoomed)
+    {
+	cScreen->damageRegion (region);
+	return;
+    }
+
+    for (out = 0; out < zooms.size (); out++)
+    {
+	CompOutput *o = &screen->outputDevs ()[out];
+	CompRegion part;
+
+	part = region.intersected (*o);
+	if (part.isEmpty ())
+	    continue;
+
+	zooms[out].sceneDamage += part;
+
+	if (mirrorActive ())
+	{
+	    int source = optionGetMirrorSource ();
+	    int target = optionGetMirrorTarget ();
+
+	    /* The source is painted unzoomed, and the target only shows
+	     * the source's zoomed view (see paintMirror) */
+	    if ((int) out == source)
+	    {
+		r += mirrorRegion (zoomedRegion (source, part));
+		continue;
+	    }
+	    else if ((int) out == target)
+	    {
+		r -= part;
+		continue;
+	    }
+	}
+
+	if (!isActive (out))
+	    continue;
+
+	/* The output itself is painted unzoomed */
+	if (lensActive (out))
+	{
+	    if (part.intersects (lensSource (out)))
+		r += lensRect (out);
+	    continue;
+	}
+
+	r -= part;
+	r += zoomedRegion (out, part);
+    }
+
+    cScreen->damageRegion (r);
+}
+
+/* Damage the whole screen for something ezoom changed itself. That
+ * leaves the unzoomed screen as it was, so glPaintOutput keeps the
+ * scene cache for the full paint that follows. A damageScreen from
+ * elsewhere in the same frame goes unnoticed.  */
+void
+EZoomScreen::damageView ()
+{
+    ownFullDamage = true;
+    cScreen->damageScreen ();
+}
+
+/* Damage a region that is already in zoomed output space */
+void
+EZoomScreen::damageZoomedRegion (const CompRegion &region)
+{
+    damagingZoomed = true;
+    cScreen->damageRegion (region);
+    damagingZoomed = false;
+}
+
+/* Mark the windows that can be skipped when painting a zoomed output:
+ * those that do not intersect the part of the unzoomed screen that is
+ * visible (or being repainted), and everything below an opaque window
+ * that covers all of it. Not while other plugins are transforming
+ * windows, as they may be painted away from where they are.  */
+void
+EZoomScreen::cullWindows (const CompRegion &visible, unsigned int mask)
+{
+    CompRect rect = visible.boundingRect ();
+    bool     occluded = false;
+
+    if (mask & PAINT_SCREEN_WITH_TRANSFORMED_WINDOWS_MASK)
+	return;
+
+    for (CompWindowList::reverse_iterator it = screen->windows ().rbegin ();
+	 it != screen->windows ().rend (); ++it)
+    {
+	CompWindow  *w = *it;
+	EZoomWindow *zw = EZoomWindow::get (w);
+
+	zw->culled = occluded || !visible.intersects (w->outputRect ());
+
+	if (!zw->culled && w->isViewable () && !w->shaded () &&
+	    !w->alpha () && zw->gWindow->paintAttrib ().opacity == OPAQUE &&
+	    w->region ().contains (rect))
+	    occluded = true;
+    }
+
+    culling = true;
+}
+
+/* Set up the scene cache: a screen sized texture with a framebuffer
+ * object to paint the unzoomed screen into. It is recreated when the
+ * screen size changes. Returns false if it can't be used.  */
+bool
+EZoomScreen::ensureSceneCache ()
+{
+    GLenum status;
+    GLint  previous;
+
+    if (!optionGetSceneCache () || !GL::fbo)
+	return false;
+
+    if (sceneWidth == screen->width () && sceneHeight == screen->height ())
+	return sceneTexture != 0;
+
+    freeSceneCache ();
+
+    sceneWidth = screen->width ();
+    sceneHeight = screen->height ();
+
+    if (GL::textureNonPowerOfTwo)
+	sceneTarget = GL_TEXTURE_2D;
+    else if (GL::textureRectangle)
+	sceneTarget = GL_TEXTURE_RECTANGLE_ARB;
+    else
+	return false;
+
+    glGenTextures (1, &sceneTexture);
+    glBindTexture (sceneTarget, sceneTexture);
+    glTexParameteri (sceneTarget, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri (sceneTarget, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D (sceneTarget, 0, GL_RGB, sceneWidth, sceneHeight, 0,
+		  GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    glBindTexture (sceneTarget, 0);
+
+    (*GL::genFramebuffers) (1, &sceneFbo);
+    previous = bindSceneFramebuffer ();
+    (*GL::framebufferTexture2D) (GL_FRAMEBUFFER_EXT,
+				 GL_COLOR_ATTACHMENT0_EXT,
+				 sceneTarget, sceneTexture, 0);
+    status = (*GL::checkFramebufferStatus) (GL_FRAMEBUFFER_EXT);
+    (*GL::bindFramebuffer) (GL_FRAMEBUFFER_EXT, previous);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE_EXT)
+    {
+	compLogMessage ("ezoom", CompLogLevelWarn,
+			"scene cache framebuffer incomplete, not using it");
+	freeSceneCache ();
+	return false;
+    }
+
+    for (unsigned int out = 0; out < zooms.size (); out++)
+	zooms[out].sceneCached = false;
+
+    return true;
+}
+
+/* Bind the scene cache for drawing or reading. Returns what was bound
+ * before, which the caller puts back rather than assuming the window.  */
+GLint
+EZoomScreen::bindSceneFramebuffer ()
+{
+    GLint previous = 0;
+
+    glGetIntegerv (GL_FRAMEBUFFER_BINDING_EXT, &previous);
+    (*GL::bindFramebuffer) (GL_FRAMEBUFFER_EXT, sceneFbo);
+
+    return previous;
+}
+
+/* Leaves the size alone, so a failed cache is not retried every frame */
+void
+EZoomScreen::freeSceneCache ()
+{
+    /* It is built for the texture target */
+    freeColorFilter ();
+
+    if (sceneFbo)
+	(*GL::deleteFramebuffers) (1, &sceneFbo);
+    if (sceneTexture)
+	glDeleteTextures (1, &sceneTexture);
+
+    sceneFbo = 0;
+    sceneTexture = 0;
+}
+
+/* True if zoomed outputs should be color filtered */
+bool
+EZoomScreen::colorFilterActive ()
+{
+    return (optionGetColorFilter () != EzoomOptions::ColorFilterNone &&
+	    GL::fragmentProgram);
+}
+
+/* True if windows should be color filtered one by one, for when the
+ * output is not drawn from the scene cache. Edge enhance is left out:
+ * each window only sees its own texels, so it would draw an edge around
+ * every window.  */
+bool
+EZoomScreen::windowFilterActive ()
+{
+    return (colorFilterActive () &&
+	    optionGetColorFilter () != EzoomOptions::ColorFilterEdgeEnhance);
+}
+
+#define FILTER_NEIGHBOURS 4
+
+/* The fragment program instructions for the color filter. ops work on
+ * the premultiplied color in output, with ezf and ezs as temporaries.
+ * Edge enhance also needs the neighbouring texels in ezn0..3: offsets
+ * leaves their texture coordinate offsets in ezo0..3, and the caller
+ * fetches them in between. texelSize is a source register holding
+ * (width, height, 0, 0) of one texel.  */
+void
+EZoomScreen::colorFilterOps (const CompString	      &texelSize,
+			     std::vector <CompString> &offsets,
+			     std::vector <CompString> &ops)
+{
+    float contrast = optionGetFilterContrast ();
+    float gamma = optionGetFilterGamma ();
+    float edge = optionGetFilterEdgeAmount ();
+
+    switch (optionGetColorFilter ())
+    {
+	case EzoomOptions::ColorFilterInvert:
+	    ops.push_back ("SUB output.rgb, output.a, output;");
+	    break;
+	case EzoomOptions::ColorFilterContrast:
+	    ops.push_back ("MUL ezf, output.a, {0.5, 0.5, 0.5, 0.5};");
+	    ops.push_back ("SUB output.rgb, output, ezf;");
+	    ops.push_back (compPrintf ("MAD output.rgb, output, "
+				       "{%f, %f, %f, 0}, ezf;",
+				       contrast, contrast, contrast));
+	    break;
+	case EzoomOptions::ColorFilterGamma:
+	    /* On the unpremultiplied color */
+	    ops.push_back ("MAX ezf.a, output.a, {0.0001, 0.0001, 0.0001, "
+			   "0.0001};");
+	    ops.push_back ("RCP ezf.a, ezf.a;");
+	    ops.push_back ("MUL ezf.rgb, output, ezf.a;");
+	    ops.push_back (compPrintf ("MOV ezs, {%f, %f, %f, %f};",
+				       gamma, gamma, gamma, gamma));
+	    ops.push_back ("POW ezf.r, ezf.r, ezs.x;");
+	    ops.push_back ("POW ezf.g, ezf.g, ezs.x;");
+	    ops.push_back ("POW ezf.b, ezf.b, ezs.x;");
+	    ops.push_back ("MUL output.rgb, ezf, output.a;");
+	    break;
+	case EzoomOptions::ColorFilterGrayscale:
+	    ops.push_back ("DP3 ezf, output, {0.299, 0.587, 0.114, 0};");
+	    ops.push_back ("MOV output.rgb, ezf;");
+	    break;
+	case EzoomOptions::ColorFilterEdgeEnhance:
+	    offsets.push_back ("MOV ezs, " + texelSize + ";");
+	    offsets.push_back ("MOV ezo0, ezs.xzzz;");
+	    offsets.push_back ("MOV ezo1, -ezs.xzzz;");
+	    offsets.push_back ("MOV ezo2, ezs.zyzz;");
+	    offsets.push_back ("MOV ezo3, -ezs.zyzz;");
+
+	    /* Subtract the laplacian */
+	    ops.push_back ("ADD ezf, ezn0, ezn1;");
+	    ops.push_back ("ADD ezf, ezf, ezn2;");
+	    ops.push_back ("ADD ezf, ezf, ezn3;");
+	    ops.push_back ("MAD ezf, output, {-4, -4, -4, -4}, ezf;");
+	    ops.push_back (compPrintf ("MAD output.rgb, ezf, "
+				       "{%f, %f, %f, 0}, output;",
+				       -edge, -edge, -edge));
+	    break;
+	default:
+	    return;
+    }
+
+    ops.push_back ("MAX output.rgb, output, {0, 0, 0, 0};");
+    ops.push_back ("MIN output.rgb, output, output.a;");
+}
+
+/* The color filter as a fragment function for window textures, built
+ * once per fetch target and parameter slot.  */
+GLFragment::FunctionId
+EZoomScreen::filterFunction (int target, int param)
+{
+    std::map <int, GLFragment::FunctionId>::iterator it;
+    std::vector <CompString>			    offsets, ops;
+    GLFragment::FunctionData			    data;
+    GLFragment::FunctionId			    id;
+    int key = param * COMP_FETCH_TARGET_NUM + target;
+
+    it = filterFunctions.find (key);
+    if (it != filterFunctions.end ())
+	return it->second;
+
+    colorFilterOps (compPrintf ("program.env[%d]", param), offsets, ops);
+
+    data.addTempHeaderOp ("ezf");
+    data.addTempHeaderOp ("ezs");
+    for (int i = 0; i < FILTER_NEIGHBOURS; i++)
+    {
+	data.addTempHeaderOp (compPrintf ("ezo%d", i).c_str ());
+	data.addTempHeaderOp (compPrintf ("ezn%d", i).c_str ());
+    }
+
+    foreach (CompString &op, offsets)
+	data.addDataOp ("%s", op.c_str ());
+
+    data.addFetchOp ("output", NULL, target);
+    if (!offsets.empty ())
+    {
+	for (int i = 0; i < FILTER_NEIGHBOURS; i++)
+	    data.addFetchOp (compPrintf ("ezn%d", i).c_str (),
+			     compPrintf ("ezo%d", i).c_str (), target);
+    }
+
+    foreach (CompString &op, ops)
+	data.addDataOp ("%s", op.c_str ());
+
+    data.addColorOp ("output", "output");
+
+    id = data.status () ? data.createFragmentFunction ("ezoom-filter") : 0;
+    filterFunctions[key] = id;
+
+    return id;
+}
+
+/* Bind the color filter program for drawing from the scene cache,
+ * building it the first time. Returns false if there is none.  */
+bool
+EZoomScreen::enableSceneFilter (float texelX, float texelY)
+{
+    std::vector <CompString> offsets, ops;
+    CompString		     program, fetch;
+    GLint		     errorPos;
+
+    if (!colorFilterActive () || sceneFilterBroken)
+	return false;
+
+    if (!sceneFilterProgram)
+    {
+	fetch = sceneTarget == GL_TEXTURE_2D ? "2D" : "RECT";
+
+	colorFilterOps (compPrintf ("{%f, %f, 0, 0}", texelX, texelY),
+			offsets, ops);
+
+	program = "!!ARBfp1.0\n"
+		  "TEMP output, ezf, ezs, ezc;\n"
+		  "TEMP ezo0, ezo1, ezo2, ezo3, ezn0, ezn1, ezn2, ezn3;\n";
+	foreach (CompString &op, offsets)
+	    program += op + "\n";
+	program += "TEX output, fragment.texcoord[0], texture[0], " +
+		   fetch + ";\n";
+	if (!offsets.empty ())
+	{
+	    for (int i = 0; i < FILTER_NEIGHBOURS; i++)
+		program += compPrintf ("ADD ezc, fragment.texcoord[0], ezo%d;\n"
+				       "TEX ezn%d, ezc, texture[0], %s;\n",
+				       i, i, fetch.c_str ());
+	}
+	foreach (CompString &op, ops)
+	    program += op + "\n";
+	program += "MOV result.color, output;\nEND\n";
+
+	glGetError ();
+
+	(*GL::genPrograms) (1, &sceneFilterProgram);
+	(*GL::bindProgram) (GL_FRAGMENT_PROGRAM_ARB, sceneFilterProgram);
+	(*GL::programString) (GL_FRAGMENT_PROGRAM_ARB,
+			      GL_PROGRAM_FORMAT_ASCII_ARB,
+			      program.size (), program.c_str ());
+	glGetIntegerv (GL_PROGRAM_ERROR_POSITION_ARB, &errorPos);
+
+	if (glGetError () != GL_NO_ERROR || errorPos != -1)
+	{
+	    compLogMessage ("ezoom", CompLogLevelWarn,
+			    "failed to load color filter program");
+	    (*GL::bindProgram) (GL_FRAGMENT_PROGRAM_ARB, 0);
+	    sceneFilterBroken = true;
+	    return false;
+	}
+    }
+    else
+    {
+	(*GL::bindProgram) (GL_FRAGMENT_PROGRAM_ARB, sceneFilterProgram);
+    }
+
+    glEnable (GL_FRAGMENT_PROGRAM_ARB);
+
+    return true;
+}
+
+/* Drop the filter programs so they get rebuilt with the new settings */
+void
+EZoomScreen::freeColorFilter ()
+{
+    std::map <int, GLFragment::FunctionId>::iterator it;
+
+    for (it = filterFunctions.begin (); it != filterFunctions.end (); ++it)
+	if (it->second)
+	    GLFragment::destroyFragmentFunction (it->second);
+    filterFunctions.clear ();
+
+    if (sceneFilterProgram)
+	(*GL::deletePrograms) (1, &sceneFilterProgram);
+    sceneFilterProgram = 0;
+    sceneFilterBroken = false;
+}
+
+void
+EZoomScreen::colorFilterChanged (CompOption	      *opt,
+				 EzoomOptions::Options num)
+{
+    freeColorFilter ();
+    damageView ();
+}
+
+/* Paint a zoomed output from the scene cache. The stale parts of the
+ * unzoomed output are repainted into the cache first; then region of
+ * the output (zoomed, see damageRegion) is drawn as one textured quad
+ * resampled from it. Frames where only the view or the cursor moved
+ * do not paint any windows.
+ *
+ * Damage reported with damageScreen is not seen in damageRegion, so
+ * glPaintOutput drops the cache on a full paint ezoom did not ask for
+ * with damageView. Plugins that change windows without damaging them paint
+ * transformed windows, and those frames skip the cache and drop it too.  */
+bool
+EZoomScreen::paintFromScene (const GLScreenPaintAttrib &attrib,
+			    const GLMatrix	      &transform,
+			    const CompRegion	      &region,
+			    CompOutput		      *output,
+			    unsigned int	      mask)
+{
+    ZoomArea   &za = zooms[output->id ()];
+    GLMatrix   sTransform = transform;
+    CompRect   box = region.boundingRect ();
+    GLenum     filter;
+    float      w = output->width (), h = output->height ();
+    float      zoom, xTranslate, yTranslate;
+    float      cx, cy, x1, y1, x2, y2;
+    float      sx = 1.0f, sy = 1.0f;
+    bool       filtered;
+
+    if (!za.sceneCached)
+	za.sceneDamage = *output;
+    else
+	za.sceneDamage = za.sceneDamage.intersected (*output);
+
+    if (!za.sceneDamage.isEmpty ())
+    {
+	unsigned int sceneMask = mask;
+
+	sceneMask &= ~(PAINT_SCREEN_TRANSFORMED_MASK |
+		       PAINT_SCREEN_FULL_MASK |
+		       PAINT_SCREEN_CLEAR_MASK);
+	sceneMask |= PAINT_SCREEN_REGION_MASK;
+
+	GLint previous = bindSceneFramebuffer ();
+
+	cullWindows (za.sceneDamage, sceneMask);
+	gScreen->glPaintOutput (attrib, transform, za.sceneDamage, output,
+				sceneMask);
+	culling = false;
+	(*GL::bindFramebuffer) (GL_FRAMEBUFFER_EXT, previous);
+
+	za.sceneCached = true;
+	za.sceneDamage = CompRegion ();
+    }
+
+    /* The part of the unzoomed screen the output shows, as in
+     * convertToUnzoomed but without rounding */
+    paintedView (output->id (), &zoom, &xTranslate, &yTranslate);
+    cx = xTranslate * (1.0f - zoom) * w + w / 2 + output->x1 ();
+    cy = yTranslate * (1.0f - zoom) * h + h / 2 + output->y1 ();
+
+    if (softwareMagnify ())
+    {
+	paintSoftware (output, box, cx - w / 2 * zoom, cy - h / 2 * zoom,
+		       zoom);
+	return true;
+    }
+    x1 = cx - w / 2 * zoom;
+    x2 = cx + w / 2 * zoom;
+    y1 = sceneHeight - (cy - h / 2 * zoom);
+    y2 = sceneHeight - (cy + h / 2 * zoom);
+
+    if (sceneTarget == GL_TEXTURE_2D)
+    {
+	sx = 1.0f / sceneWidth;
+	sy = 1.0f / sceneHeight;
+    }
+
+    filter = gScreen->textureFilter () == GL_NEAREST ? GL_NEAREST : GL_LINEAR;
+
+    sTransform.toScreenSpace (output, -DEFAULT_Z_CAMERA);
+    glPushMatrix ();
+    glLoadMatrixf (sTransform.getMatrix ());
+
+    glEnable (GL_SCISSOR_TEST);
+    glScissor (box.x1 (), screen->height () - box.y2 (),
+	       box.width (), box.height ());
+
+    glColor4usv (defaultColor);
+    glEnable (sceneTarget);
+    glBindTexture (sceneTarget, sceneTexture);
+    glTexParameteri (sceneTarget, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri (sceneTarget, GL_TEXTURE_MAG_FILTER, filter);
+
+    /* The color filter is applied in the same pass */
+    filtered = enableSceneFilter (sx, sy);
+
+    glBegin (GL_QUADS);
+    glTexCoord2f (x1 * sx, y1 * sy);
+    glVertex2i (output->x1 (), output->y1 ());
+    glTexCoord2f (x1 * sx, y2 * sy);
+    glVertex2i (output->x1 (), output->y2 ());
+    glTexCoord2f (x2 * sx, y2 * sy);
+    glVertex2i (output->x2 (), output->y2 ());
+    glTexCoord2f (x2 * sx, y1 * sy);
+    glVertex2i (output->x2 (), output->y1 ());
+    glEnd ();
+
+    if (filtered)
+    {
+	glDisable (GL_FRAGMENT_PROGRAM_ARB);
+	(*GL::bindProgram) (GL_FRAGMENT_PROGRAM_ARB, 0);
+    }
+
+    glBindTexture (sceneTarget, 0);
+    glDisable (sceneTarget);
+    glDisable (GL_SCISSOR_TEST);
+    glPopMatrix ();
+
+    return true;
+}
+
+/* glWindowPos2i is GL 1.4, look it up when first needed */
+bool
+EZoomScreen::loadWindowPos ()
+{
+    if (!windowPos2i)
+	windowPos2i = (WindowPos2iProc)
+	    gScreen->getProcAddress ("glWindowPos2i");
+    if (!windowPos2i)
+	windowPos2i = (WindowPos2iProc)
+	    gScreen->getProcAddress ("glWindowPos2iARB");
+
+    return windowPos2i != NULL;
+}
+
+/* True if the zoomed view should be scaled on the CPU by
+ * paintSoftware. Automatically only with a software rasterizer, where
+ * every texel fetch runs through a generic shader loop and our own
+ * kernel is several times faster. The color filter has no CPU version,
+ * so it keeps the GL path.  */
+bool
+EZoomScreen::softwareMagnify ()
+{
+    if (optionGetSoftwareMagnify () == EzoomOptions::SoftwareMagnifyNever ||
+	colorFilterActive () || !loadWindowPos ())
+	return false;
+
+    if (optionGetSoftwareMagnify () == EzoomOptions::SoftwareMagnifyAlways)
+	return true;
+
+    if (softwareGL < 0)
+    {
+	const char *renderer = (const char *) glGetString (GL_RENDERER);
+
+	softwareGL = renderer &&
+		     (strstr (renderer, "llvmpipe") ||
+		      strstr (renderer, "softpipe") ||
+		      strstr (renderer, "Software Rasterizer") ||
+		      strstr (renderer, "swrast"));
+
+	if (softwareGL)
+	    compLogMessage ("ezoom", CompLogLevelInfo,
+			    "software renderer %s, magnifying on the CPU",
+			    renderer);
+    }
+
+    return softwareGL;
+}
+
+/* Paint box of the output from the scene cache, scaled on the CPU.
+ * left, top and zoom give the part of the unzoomed screen the output
+ * shows. Only the source pixels under box are read back, and the
+ * result is written with glDrawPixels.  */
+void
+EZoomScreen::paintSoftware (CompOutput     *output,
+			    const CompRect &box,
+			    float	   left,
+			    float	   top,
+			    float	   zoom)
+{
+    float   sx1, sy1, sx2, sy2;
+    int     x1, y1, x2, y2;
+    GLint   previous;
+    bool    nearest;
+
+    if (box.isEmpty ())
+	return;
+
+    /* The source rect under box, plus a pixel for the filter */
+    sx1 = left + (box.x1 () - output->x1 ()) * zoom;
+    sy1 = top + (box.y1 () - output->y1 ()) * zoom;
+    sx2 = left + (box.x2 () - output->x1 ()) * zoom;
+    sy2 = top + (box.y2 () - output->y1 ()) * zoom;
+
+    x1 = MAX (0, (int) floor (sx1) - 1);
+    y1 = MAX (0, (int) floor (sy1) - 1);
+    x2 = MIN (sceneWidth, (int) ceil (sx2) + 1);
+    y2 = MIN (sceneHeight, (int) ceil (sy2) + 1);
+
+    if (x2 <= x1 || y2 <= y1)
+	return;
+
+    softwareSource.resize ((x2 - x1) * (y2 - y1));
+    softwareScaled.resize (box.width () * box.height ());
+
+    previous = bindSceneFramebuffer ();
+    glReadPixels (x1, sceneHeight - y2, x2 - x1, y2 - y1,
+		  GL_BGRA, GL_UNSIGNED_BYTE, &softwareSource[0]);
+    (*GL::bindFramebuffer) (GL_FRAMEBUFFER_EXT, previous);
+
+    nearest = gScreen->textureFilter () == GL_NEAREST;
+
+    scaler.scale (&softwareSource[0], x2 - x1, y2 - y1,
+		  &softwareScaled[0], box.width (), box.height (),
+		  sx1 - x1, sy1 - y1, zoom, !nearest);
+
+    (*windowPos2i) (box.x1 (), screen->height () - box.y2 ());
+    glDrawPixels (box.width (), box.height (), GL_BGRA, GL_UNSIGNED_BYTE,
+		  &softwareScaled[0]);
+}
+
+#define LENS_SEGMENTS 64
+
+EZoomScreen::FrameCopy::FrameCopy () :
+    texture (0),
+    target (GL_TEXTURE_RECTANGLE_ARB),
+    width (0),
+    height (0)
+{
+}
+
+/* Copy rect of the back buffer into the texture, growing it as needed.
+ * Leaves the texture bound and its target enabled.  */
+void
+EZoomScreen::FrameCopy::copy (const CompRect &rect)
+{
+    if (!texture)
+    {
+	target = GL::textureRectangle ? GL_TEXTURE_RECTANGLE_ARB :
+					GL_TEXTURE_2D;
+	glGenTextures (1, &texture);
+	width = height = 0;
+    }
+
+    glEnable (target);
+    glBindTexture (target, texture);
+
+    if (rect.width () > width || rect.height () > height)
+    {
+	width = MAX (rect.width (), width);
+	height = MAX (rect.height (), height);
+	glTexParameteri (target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri (target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D (target, 0, GL_RGB, width, height, 0,
+		      GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    }
+
+    glCopyTexSubImage2D (target, 0, 0, 0,
+			 rect.x1 (), screen->height () - rect.y2 (),
+			 rect.width (), rect.height ());
+}
+
+void
+EZoomScreen::FrameCopy::fini ()
+{
+    if (texture)
+	glDeleteTextures (1, &texture);
+    texture = 0;
+}
+
+/* True if the output shows its zoomed view in a lens around the pointer
+ * instead of as a whole */
+bool
+EZoomScreen::lensActive (int out)
+{
+    return (optionGetLensShape () != EzoomOptions::LensShapeOff &&
+	    isActive (out) && (GL::textureRectangle ||
+			       GL::textureNonPowerOfTwo));
+}
+
+/* The lens, centered on the zoomed pointer and clipped to the output.
+ * What it shows is the zoomed view of the output at the same place.  */
+CompRect
+EZoomScreen::lensRect (int out)
+{
+    CompOutput *o = &screen->outputDevs ()[out];
+    int	       w = MIN (optionGetLensWidth (), o->width ());
+    int	       h = MIN (optionGetLensHeight (), o->height ());
+    int	       x, y;
+
+    convertToZoomed (out, mouse.x (), mouse.y (), &x, &y);
+
+    x = MAX (o->x1 (), MIN (x - w / 2, o->x2 () - w));
+    y = MAX (o->y1 (), MIN (y - h / 2, o->y2 () - h));
+
+    return CompRect (x, y, w, h);
+}
+
+/* The part of the unzoomed output that shows up in the lens */
+CompRect
+EZoomScreen::lensSource (int out)
+{
+    CompRect lens = lensRect (out);
+
+    return unzoomedRegion (out, lens).intersected (
+			   screen->outputDevs ()[out]).boundingRect ();
+}
+
+CompRegion
+EZoomScreen::lensRegion ()
+{
+    CompRegion region;
+
+    for (unsigned int out = 0; out < zooms.size (); out++)
+	if (lensActive (out))
+	    region += lensRect (out);
+
+    return region;
+}
+
+/* Repaint where the lens was and is. Everything that moves the lens
+ * goes through here.  */
+void
+EZoomScreen::damageLens ()
+{
+    CompRegion lens = lensRegion ();
+
+    damageZoomedRegion (lastLens + lens);
+    lastLens = lens;
+}
+
+/* Copy the source of the lens from what was just painted and draw it
+ * magnified over the lens, as a rectangle or as the inscribed ellipse.
+ * The texture coordinates of each vertex come from the same zoom and
+ * translation the whole output would be painted with.  */
+void
+EZoomScreen::drawLens (CompOutput     *output,
+		       const GLMatrix &transform,
+		       const CompRect &lens,
+		       const CompRect &source)
+{
+    GLMatrix sTransform = transform;
+    GLenum   filter;
+    float    zoom, xTranslate, yTranslate;
+    float    w = output->width (), h = output->height ();
+    float    sx = 1.0f, sy = 1.0f;
+    float    cx, cy, rx, ry;
+    int	     out = output->id ();
+
+    if (source.isEmpty ())
+	return;
+
+    lensCopy.copy (source);
+
+    if (lensCopy.target == GL_TEXTURE_2D)
+    {
+	sx = 1.0f / lensCopy.width;
+	sy = 1.0f / lensCopy.height;
+    }
+
+    filter = pixelExact (out) || gScreen->textureFilter () == GL_NEAREST ?
+	     GL_NEAREST : GL_LINEAR;
+    glTexParameteri (lensCopy.target, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri (lensCopy.target, GL_TEXTURE_MAG_FILTER, filter);
+
+    paintedView (out, &zoom, &xTranslate, &yTranslate);
+
+    sTransform.toScreenSpace (output, -DEFAULT_Z_CAMERA);
+    glPushMatrix ();
+    glLoadMatrixf (sTransform.getMatrix ());
+    glColor4usv (defaultColor);
+
+    cx = (lens.x1 () + lens.x2 ()) / 2.0f;
+    cy = (lens.y1 () + lens.y2 ()) / 2.0f;
+    rx = lens.width () / 2.0f;
+    ry = lens.height () / 2.0f;
+
+#define LENS_VERTEX(vx, vy)						       \
+    {									       \
+	float ux = ((vx) - output->x1 () - w / 2) * zoom +		       \
+		   xTranslate * (1.0f - zoom) * w + w / 2 + output->x1 ();    \
+	float uy = ((vy) - output->y1 () - h / 2) * zoom +		       \
+		   yTranslate * (1.0f - zoom) * h + h / 2 + output->y1 ();    \
+	glTexCoord2f ((ux - source.x1 ()) * sx, (source.y2 () - uy) * sy);     \
+	glVertex2f ((vx), (vy));					       \
+    }
+
+    if (optionGetLensShape () == EzoomOptions::LensShapeCircle)
+    {
+	glBegin (GL_TRIANGLE_FAN);
+	LENS_VERTEX (cx, cy);
+	for (int i = 0; i <= LENS_SEGMENTS; i++)
+	{
+	    float a = 2.0f * M_PI * i / LENS_SEGMENTS;
+
+	    LENS_VERTEX (cx + rx * cos (a), cy + ry * sin (a));
+	}
+	glEnd ();
+    }
+    else
+    {
+	glBegin (GL_QUADS);
+	LENS_VERTEX (lens.x1 (), lens.y1 ());
+	LENS_VERTEX (lens.x1 (), lens.y2 ());
+	LENS_VERTEX (lens.x2 (), lens.y2 ());
+	LENS_VERTEX (lens.x2 (), lens.y1 ());
+	glEnd ();
+    }
+
+#undef LENS_VERTEX
+
+    glBindTexture (lensCopy.target, 0);
+    glDisable (lensCopy.target);
+    glPopMatrix ();
+}
+
+/* Paint an output in lens mode: the output as it is, with the lens over
+ * it. The lens only needs redrawing when the damage reaches it (see
+ * damageRegion and damageLens); then its area and its source are
+ * painted unzoomed too, to copy the source from and to draw over.  */
+bool
+EZoomScreen::paintLens (const GLScreenPaintAttrib &attrib,
+			const GLMatrix		  &transform,
+			const CompRegion	  &region,
+			CompOutput		  *output,
+			unsigned int		  mask)
+{
+    CompRect   lens = lensRect (output->id ());
+    CompRect   source = lensSource (output->id ());
+    CompRegion damage = region;
+    bool       status;
+
+    if ((mask & PAINT_SCREEN_REGION_MASK) &&
+	!(mask & PAINT_SCREEN_FULL_MASK))
+    {
+	if (!region.intersects (lens))
+	    return gScreen->glPaintOutput (attrib, transform, region, output,
+					   mask);
+
+	damage += lens;
+	damage += source;
+    }
+
+    status = gScreen->glPaintOutput (attrib, transform, damage, output,
+				     mask);
+    drawLens (output, transform, lens, source);
+
+    return status;
+}
+
+/* True if the zoomed view of the mirror source output is shown on the
+ * mirror target output, with the source itself left unzoomed.  */
+bool
+EZoomScreen::mirrorActive ()
+{
+    int source = optionGetMirrorSource ();
+    int target = optionGetMirrorTarget ();
+    int n = zooms.size ();
+
+    return (optionGetMirror () && source != target &&
+	    source < n && target < n && isActive (source) &&
+	    (GL::textureRectangle || GL::textureNonPowerOfTwo));
+}
+
+/* Where a region of the mirror source, in zoomed output space, shows up
+ * on the mirror target.  */
+CompRegion
+EZoomScreen::mirrorRegion (const CompRegion &region)
+{
+    CompOutput *so = &screen->outputDevs ()[optionGetMirrorSource ()];
+    CompOutput *to = &screen->outputDevs ()[optionGetMirrorTarget ()];
+    float      sx = (float) to->width () / so->width ();
+    float      sy = (float) to->height () / so->height ();
+    CompRegion result;
+
+    foreach (const CompRect &r, region.rects ())
+    {
+	int x1 = floor ((r.x1 () - so->x1 ()) * sx) + to->x1 ();
+	int y1 = floor ((r.y1 () - so->y1 ()) * sy) + to->y1 ();
+	int x2 = ceil ((r.x2 () - so->x1 ()) * sx) + to->x1 ();
+	int y2 = ceil ((r.y2 () - so->y1 ()) * sy) + to->y1 ();
+
+	result += CompRect (x1, y1, x2 - x1, y2 - y1);
+    }
+
+    return result.intersected (*to);
+}
+
+/* Paint the mirror source as it is, then copy the part of it that its
+ * zoomed view shows and draw that over the whole target, so the scene
+ * is painted only once. The copy is kept: when only the target is
+ * damaged (the cursor or the box moved) it paints itself from it, the
+ * source being unchanged since. If the target came first in a frame
+ * that also repaints the source, it is drawn again here from the new
+ * copy.  */
+bool
+EZoomScreen::paintMirror (const GLScreenPaintAttrib &attrib,
+			  const GLMatrix	    &transform,
+			  const CompRegion	    &region,
+			  CompOutput		    *output,
+			  unsigned int		    mask)
+{
+    bool     status;
+    float    x1, y1, x2, y2;
+    CompRect source;
+
+    status = gScreen->glPaintOutput (attrib, transform, region, output,
+				     mask);
+
+    mirrorView (output, &x1, &y1, &x2, &y2);
+    source = CompRegion (floor (x1), floor (y1),
+			 ceil (x2) - floor (x1), ceil (y2) - floor (y1)).
+	     intersected (*output).boundingRect ();
+    if (source.isEmpty ())
+	return status;
+
+    mirrorCopy.copy (source);
+    mirrorRect = source;
+
+    drawMirror (output, transform);
+    mirrorDrawn = true;
+
+    glViewport (output->x1 (), screen->height () - output->y2 (),
+		output->width (), output->height ());
+
+    return status;
+}
+
+/* The part of the mirror source, in screen coordinates, that its zoomed
+ * view shows, as in paintFromScene */
+void
+EZoomScreen::mirrorView (CompOutput *output,
+			 float	    *x1,
+			 float	    *y1,
+			 float	    *x2,
+			 float	    *y2)
+{
+    float zoom, xTranslate, yTranslate;
+    float w = output->width (), h = output->height ();
+    float cx, cy;
+
+    paintedView (output->id (), &zoom, &xTranslate, &yTranslate);
+    cx = xTranslate * (1.0f - zoom) * w + w / 2 + output->x1 ();
+    cy = yTranslate * (1.0f - zoom) * h + h / 2 + output->y1 ();
+    *x1 = cx - w / 2 * zoom;
+    *x2 = cx + w / 2 * zoom;
+    *y1 = cy - h / 2 * zoom;
+    *y2 = cy + h / 2 * zoom;
+}
+
+/* Draw the mirror target from the last copy of the source, with the
+ * scaled cursor and the box over it. Leaves the viewport on the
+ * target.  */
+void
+EZoomScreen::drawMirror (CompOutput	*output,
+			 const GLMatrix &transform)
+{
+    CompOutput *target = &screen->outputDevs ()[optionGetMirrorTarget ()];
+    GLMatrix   sTransform = transform;
+    CompRect   &source = mirrorRect;
+    GLenum     filter;
+    float      x1, y1, x2, y2;
+    float      sx = 1.0f, sy = 1.0f;
+
+    if (!mirrorCopy.texture || source.isEmpty ())
+	return;
+
+    mirrorView (output, &x1, &y1, &x2, &y2);
+
+    if (mirrorCopy.target == GL_TEXTURE_2D)
+    {
+	sx = 1.0f / mirrorCopy.width;
+	sy = 1.0f / mirrorCopy.height;
+    }
+
+    glEnable (mirrorCopy.target);
+    glBindTexture (mirrorCopy.target, mirrorCopy.texture);
+
+    filter = pixelExact (output->id ()) ||
+	     gScreen->textureFilter () == GL_NEAREST ? GL_NEAREST : GL_LINEAR;
+    glTexParameteri (mirrorCopy.target, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri (mirrorCopy.target, GL_TEXTURE_MAG_FILTER, filter);
+
+    /* Drawn as if on the source, the viewport scales it to the target */
+    glViewport (target->x1 (), screen->height () - target->y2 (),
+		target->width (), target->height ());
+
+    sTransform.toScreenSpace (output, -DEFAULT_Z_CAMERA);
+    glPushMatrix ();
+    glLoadMatrixf (sTransform.getMatrix ());
+    glColor4usv (defaultColor);
+
+    glBegin (GL_QUADS);
+    glTexCoord2f ((x1 - source.x1 ()) * sx, (source.y2 () - y1) * sy);
+    glVertex2i (output->x1 (), output->y1 ());
+    glTexCoord2f ((x1 - source.x1 ()) * sx, (source.y2 () - y2) * sy);
+    glVertex2i (output->x1 (), output->y2 ());
+    glTexCoord2f ((x2 - source.x1 ()) * sx, (source.y2 () - y2) * sy);
+    glVertex2i (output->x2 (), output->y2 ());
+    glTexCoord2f ((x2 - source.x1 ()) * sx, (source.y2 () - y1) * sy);
+    glVertex2i (output->x2 (), output->y1 ());
+    glEnd ();
+
+    glBindTexture (mirrorCopy.target, 0);
+    glDisable (mirrorCopy.target);
     glPopMatrix ();
+
+    /* The scaled cursor and the box go with the zoomed view */
+    drawingMirror = true;
+    drawOverlays (output, transform);
+    drawingMirror = false;
+}
+
+/* Repaint just the damaged part of a zoomed output whose view did not
+ * move. region is in zoomed output space (see damageRegion); windows
+ * are painted for the unzoomed part of the screen that shows up there,
+ * with clearing and drawing scissored to it. This goes down the chain
+ * as a full transformed paint, as the full frame does, since that is
+ * the only kind of transformed paint core does; the culling and the
+ * scissor keep it to the damage.  */
+bool
+EZoomScreen::paintZoomedRegion (const GLScreenPaintAttrib &attrib,
+			       const GLMatrix		 &transform,
+			       const CompRegion		 &region,
+			       CompOutput		 *output,
+			       unsigned int		 mask)
+{
+    CompRegion damage = region.intersected (*output);
+    CompRect   box;
+    bool       status;
+
+    if (damage.isEmpty ())
+	return true;
+
+    box = damage.boundingRect ();
+
+    mask &= ~PAINT_SCREEN_REGION_MASK;
+    mask |= PAINT_SCREEN_CLEAR_MASK | PAINT_SCREEN_FULL_MASK;
+
+    CompRegion source = unzoomedRegion (output->id (), damage);
+
+    cullWindows (source, mask);
+
+    glEnable (GL_SCISSOR_TEST);
+    glScissor (box.x1 (), screen->height () - box.y2 (),
+	       box.width (), box.height ());
+    status = gScreen->glPaintOutput (attrib, transform, source, output,
+				     mask);
+    glDisable (GL_SCISSOR_TEST);
+
+    culling = false;
+
+    return status;
 }
+
 /* Apply the zoom if we are grabbed.
  * Make sure to use the correct filter.
+ *
+ * While the view is still, only the damaged part of the output is
+ * repainted. Frames where the view moves repaint the whole output; if
+ * we get a region paint for one of those, returning false makes the
+ * caller repaint the output in full. Either is served from the scene
+ * cache when we can.
  */
 bool
 EZoomScreen::glPaintOutput (const GLScreenPaintAttrib &attrib,
@@ -425,35 +2390,103 @@ EZoomScreen::glPaintOutput (const GLScreenPaintAttrib &attrib,
     bool status;
     int	 out = output->id ();
 
-    if (isActive (out))
+    if (mirrorActive ())
+    {
+	/* Drawn from the source (see paintMirror), unless that has
+	 * already happened this frame */
+	if (out == optionGetMirrorTarget ())
+	{
+	    if (!mirrorDrawn)
+		drawMirror (&screen->outputDevs ()[optionGetMirrorSource ()],
+			    transform);
+	    return true;
+	}
+    }
+
+    if (mirrorActive () && out == optionGetMirrorSource ())
+    {
+	status = paintMirror (attrib, transform, region, output, mask);
+	zooms[out].viewPainted ();
+    }
+    else if (lensActive (out))
+    {
+	status = paintLens (attrib, transform, region, output, mask);
+	zooms[out].viewPainted ();
+    }
+    else if (isActive (out))
     {
 	GLScreenPaintAttrib sa = attrib;
 	GLMatrix            zTransform = transform;
+	ZoomArea            &za = zooms[out];
+	GLenum		    filter = gScreen->textureFilter ();
+	float		    zoom, xTranslate, yTranslate;
 
-	mask &= ~PAINT_SCREEN_REGION_MASK;
-	mask |= PAINT_SCREEN_CLEAR_MASK;
+	paintedView (out, &zoom, &xTranslate, &yTranslate);
 
-	zTransform.scale (1.0f / zooms.at (out).currentZoom,
-		          1.0f / zooms.at (out).currentZoom,
+	zTransform.scale (1.0f / zoom,
+			  1.0f / zoom,
 		          1.0f);
-	zTransform.translate (zooms.at (out).xtrans,
-			      zooms.at (out).ytrans,
+	zTransform.translate (-xTranslate * (1.0f - zoom),
+			      yTranslate * (1.0f - zoom),
 			      0);
 
 	mask |= PAINT_SCREEN_TRANSFORMED_MASK;
 
-	status = gScreen->glPaintOutput (sa, zTransform, region, output, mask);
+	bool regionPaint = (mask & PAINT_SCREEN_REGION_MASK) &&
+			   !(mask & PAINT_SCREEN_FULL_MASK);
 
-	drawCursor (output, transform);
+	if (regionPaint && za.viewChanged ())
+	{
+	    ownFullDamage = true;
+	    return false;
+	}
+
+	if (pixelExact (out))
+	    gScreen->setTextureFilter (GL_NEAREST);
+
+	/* A full paint ezoom did not ask for comes from damageScreen,
+	 * which does not go through damageRegion */
+	if ((mask & PAINT_SCREEN_WITH_TRANSFORMED_WINDOWS_MASK) ||
+	    ((mask & PAINT_SCREEN_FULL_MASK) && !ownFullDamage))
+	    za.sceneCached = false;
+
+	if (!(mask & PAINT_SCREEN_WITH_TRANSFORMED_WINDOWS_MASK) &&
+	    ensureSceneCache ())
+	{
+	    status = paintFromScene (sa, transform, regionPaint ?
+				     region.intersected (*output) :
+				     CompRegion (*output), output, mask);
+	}
+	else if (regionPaint)
+	{
+	    filtering = windowFilterActive ();
+	    status = paintZoomedRegion (sa, zTransform, region, output, mask);
+	    filtering = false;
+	}
+	else
+	{
+	    mask &= ~PAINT_SCREEN_REGION_MASK;
+	    mask |= PAINT_SCREEN_CLEAR_MASK;
+
+	    cullWindows (unzoomedRegion (out, *output), mask);
+	    filtering = windowFilterActive ();
+	    status = gScreen->glPaintOutput (sa, zTransform, region, output,
+					     mask);
+	    filtering = false;
+	    culling = false;
+	}
 
+	za.viewPainted ();
+
+	gScreen->setTextureFilter (filter);
     }
     else
     {
 	status = gScreen->glPaintOutput (attrib, transform, region, output,
 									mask);
     }
-    if (grabIndex)
-	drawBox (transform, output, box);
+
+    drawOverlays (output, transform);
 
     return status;
 }
@@ -462,23 +2495,23 @@ EZoomScreen::glPaintOutput (const GLScreenPaintAttrib &attrib,
  * We are restricted to 0.5 to not go beyond the end
  * of the screen/head.  */
 static inline void
-constrainZoomTranslate ()
+constrainZoomTranslate (int out)
 {
-    unsigned int out;
     ZOOM_SCREEN (screen);
 
-    for (out = 0; out < zs->zooms.size (); out++)
-    {
-	if (zs->zooms.at (out).xTranslate > 0.5f)
-	    zs->zooms.at (out).xTranslate = 0.5f;
-	else if (zs->zooms.at (out).xTranslate < -0.5f)
-	    zs->zooms.at (out).xTranslate = -0.5f;
+    EZoomScreen::ZoomArea &za = zs->zooms[out];
 
-	if (zs->zooms.at (out).yTranslate > 0.5f)
-	    zs->zooms.at (out).yTranslate = 0.5f;
-	else if (zs->zooms.at (out).yTranslate < -0.5f)
-	    zs->zooms.at (out).yTranslate = -0.5f;
-    }
+    if (za.xTranslate > 0.5f)
+	za.xTranslate = 0.5f;
+    else if (za.xTranslate < -0.5f)
+	za.xTranslate = -0.5f;
+
+    if (za.yTranslate > 0.5f)
+	za.yTranslate = 0.5f;
+    else if (za.yTranslate < -0.5f)
+	za.yTranslate = -0.5f;
+
+    zs->markMoving (out);
 }
 
 /* Functions for adjusting the zoomed area.
@@ -508,6 +2541,7 @@ EZoomScreen::setCenter (int x, int y, bool instant)
 	((x - o->x1 ()) - o->width ()  / 2) / (o->width ());
     zooms.at (out).yTranslate = (float)
 	((y - o->y1 ()) - o->height () / 2) / (o->height ());
+    markMoving (out);
 
     if (instant)
     {
@@ -548,7 +2582,7 @@ EZoomScreen::setZoomArea (int        x,
 	(float) -((o->height () / 2) - (y + (height / 2) - o->y1 ()))
 	/ (o->height ());
     zooms.at (out).yTranslate /= (1.0f - zooms.at (out).newZoom);
-    constrainZoomTranslate ();
+    constrainZoomTranslate (out);
 
     if (instant)
     {
@@ -588,9 +2622,252 @@ EZoomScreen::panZoom (int xvalue, int yvalue)
 	zooms.at (out).yTranslate +=
 	    optionGetPanFactor () * yvalue *
 	    zooms.at (out).currentZoom;
+	constrainZoomTranslate (out);
+    }
+}
+
+/* Pans the zoomed area from the frame loop. Real and target translation
+ * are moved together, so the springs are left alone and the motion is
+ * whatever the caller integrates at frame rate. The start and target of
+ * a motion in progress move along too, so that it is not restarted and
+ * a zoom running at the same time keeps its timing.  */
+void
+EZoomScreen::panArea (int out, float dx, float dy)
+{
+    ZoomArea &za = zooms[out];
+    GLfloat  x = za.xTranslate, y = za.yTranslate;
+    GLfloat  realX = za.realXTranslate, realY = za.realYTranslate;
+
+    za.xTranslate = MAX (MIN (za.xTranslate + dx, 0.5f), -0.5f);
+    za.yTranslate = MAX (MIN (za.yTranslate + dy, 0.5f), -0.5f);
+    za.realXTranslate = MAX (MIN (za.realXTranslate + dx, 0.5f), -0.5f);
+    za.realYTranslate = MAX (MIN (za.realYTranslate + dy, 0.5f), -0.5f);
+    za.xVelocity = za.yVelocity = 0.0f;
+
+    za.targetXTranslate += za.xTranslate - x;
+    za.targetYTranslate += za.yTranslate - y;
+    za.startXTranslate += za.realXTranslate - realX;
+    za.startYTranslate += za.realYTranslate - realY;
+    /* A flight would put the view back where it was */
+    za.flight.active = false;
+
+    za.updateActualTranslates ();
+    markMoving (out);
+}
+
+/* Pans for as long as pan keys are held. Speeds up to pan_max_speed at
+ * pan_acceleration, and comes to a stop at twice that rate once the keys
+ * are released. This gives one smooth motion at frame rate rather than
+ * a jump per key repeat.  */
+void
+EZoomScreen::continuousPan (float ms)
+{
+    float        accel = optionGetPanAcceleration () * ms / 1000.0f;
+    float        step;
+    unsigned int out;
+
+    if (panKeys)
+    {
+	panXDirection = (panKeys & PAN_RIGHT ? 1.0f : 0.0f) -
+			(panKeys & PAN_LEFT ? 1.0f : 0.0f);
+	panYDirection = (panKeys & PAN_DOWN ? 1.0f : 0.0f) -
+			(panKeys & PAN_UP ? 1.0f : 0.0f);
+	panSpeed = MIN (panSpeed + accel, optionGetPanMaxSpeed ());
     }
+    else
+	panSpeed = MAX (panSpeed - 2.0f * accel, 0.0f);
+
+    if (panSpeed == 0.0f)
+	return;
+
+    step = panSpeed * ms / 1000.0f;
+
+    for (out = 0; out < zooms.size (); out++)
+    {
+	ZoomArea &za = zooms[out];
+
+	if (za.locked || !(grabbed & (1 << za.output)))
+	    continue;
+
+	panArea (out,
+		 panXDirection * step * za.currentZoom,
+		 panYDirection * step * za.currentZoom);
+    }
+
+    damageView ();
+}
+
+/* Edge Push mode: pan towards the zoomed pointer when it comes within
+ * edge_push_margin of an edge of the output, faster the closer it gets.
+ * This is re-evaluated every frame as the view moves under a still
+ * pointer, and needs no pointer warps.  */
+void
+EZoomScreen::edgePush (float ms)
+{
+    int        out, x, y, margin;
+    float      vx = 0.0f, vy = 0.0f, step;
+    CompOutput *o;
+
+    edgePushing = false;
+
+    if (optionGetZoomMode () != EzoomOptions::ZoomModeEdgePush)
+	return;
+
+    out = screen->outputDeviceForPoint (mouse.x (), mouse.y ());
+    if (!isActive (out) || zooms[out].locked)
+	return;
+
+    o = &screen->outputDevs ()[out];
+    margin = MIN (optionGetEdgePushMargin (),
+		  MIN (o->width (), o->height ()) / 4);
+    convertToZoomed (out, mouse.x (), mouse.y (), &x, &y);
+
+    if (x > o->x2 () - margin)
+	vx = (float) (x - o->x2 () + margin) / margin;
+    else if (x < o->x1 () + margin)
+	vx = (float) (x - o->x1 () - margin) / margin;
+
+    if (y > o->y2 () - margin)
+	vy = (float) (y - o->y2 () + margin) / margin;
+    else if (y < o->y1 () + margin)
+	vy = (float) (y - o->y1 () - margin) / margin;
+
+    vx = MAX (MIN (vx, 1.0f), -1.0f);
+    vy = MAX (MIN (vy, 1.0f), -1.0f);
+
+    /* Against the edge of the desktop, nowhere left to go */
+    if ((vx > 0.0f && zooms[out].xTranslate >= 0.5f) ||
+	(vx < 0.0f && zooms[out].xTranslate <= -0.5f))
+	vx = 0.0f;
+    if ((vy > 0.0f && zooms[out].yTranslate >= 0.5f) ||
+	(vy < 0.0f && zooms[out].yTranslate <= -0.5f))
+	vy = 0.0f;
+
+    if (vx == 0.0f && vy == 0.0f)
+	return;
+
+    step = optionGetEdgePushSpeed () * ms / 1000.0f * zooms[out].currentZoom;
+    panArea (out, vx * step, vy * step);
+    edgePushing = true;
+
+    damageView ();
+}
+
+/* Pointer tracking.
+ *
+ * With XInput 2.1 the pointer is followed from raw motion events, which
+ * reach the root window wherever the pointer is, also while another
+ * client has it grabbed; 2.0 did not send them during grabs, so it is
+ * not used. They carry no position, so a burst of them is answered with one
+ * XQueryPointer from motionTimer, and nothing at all happens while the
+ * pointer is still.
+ *
+ * Otherwise mousepoll polls for us. As that wakes us up at its
+ * interval even when nothing moves, idleTimer stops it after
+ * POINTER_IDLE_MS without motion and checks the pointer itself every
+ * POINTER_IDLE_POLL_MS until it moves again.
+ */
+#define POINTER_IDLE_MS	     1000
+#define POINTER_IDLE_POLL_MS 250
+
+/* Pointer warps.
+ *
+ * Restraining, syncing and centering all warp the pointer, several
+ * times a frame at worst, and each warp is a round trip that comes
+ * back as more motion. They only note what they want here, and
+ * flushWarp warps once per frame from preparePaint, or from warpTimer
+ * if no frame comes. Restraining and syncing work out their target
+ * only then, from the pointer as last reported, so motion reported in
+ * between is not undone; mouse itself stays where the pointer was
+ * reported until the warp is. The motion a warp causes is recognised
+ * by its position in updateMousePosition and not acted upon again.
+ */
+void
+EZoomScreen::queueWarp (int x, int y)
+{
+    warpTarget = CompPoint (x, y);
+    warpPending = true;
+    scheduleWarp ();
+}
+
+void
+EZoomScreen::scheduleWarp ()
+{
+    if (!warpTimer.active ())
+	warpTimer.start (cScreen->optimalRedrawTime (),
+			 cScreen->optimalRedrawTime () * 2);
+}
+
+bool
+EZoomScreen::flushWarp ()
+{
+    int x, y;
+
+    warpTimer.stop ();
+
+    if (warpSync && syncWarpTarget (&x, &y))
+    {
+	warpTarget = CompPoint (x, y);
+	warpPending = true;
+    }
+    if (warpRestrain >= 0 && isActive (warpRestrain) &&
+	restrainWarpTarget (warpRestrain, &x, &y))
+    {
+	warpTarget = CompPoint (x, y);
+	warpPending = true;
+    }
+    warpSync = false;
+    warpRestrain = -1;
+
+    if (!warpPending)
+	return false;
+
+    warpPending = false;
+
+    if (warpTarget.x () == pointerX && warpTarget.y () == pointerY)
+	return false;
+
+    screen->warpPointer (warpTarget.x () - pointerX,
+			 warpTarget.y () - pointerY);
+    warpedTo = warpTarget;
+    warpExpected = true;
+
+    return false;
+}
+
+/* Select raw motion on the root window, or stop. XISelectEvents
+ * replaces all that this connection selects there for a device, and
+ * core and the other plugins share the connection, so their part of
+ * the selection is read back and kept. Returns whether raw motion was
+ * selected before.  */
+bool
+EZoomScreen::selectRawMotion (bool on)
+{
+    unsigned char bits[XIMaskLen (XI_LASTEVENT)] = { 0 };
+    XIEventMask   mask, *selected;
+    bool	  was;
+    int		  n = 0;
+
+    selected = XIGetSelectedEvents (screen->dpy (), screen->root (), &n);
+    for (int i = 0; selected && i < n; i++)
+	if (selected[i].deviceid == XIAllMasterDevices)
+	    memcpy (bits, selected[i].mask,
+		    MIN (selected[i].mask_len, (int) sizeof (bits)));
+    if (selected)
+	XFree (selected);
+
+    was = XIMaskIsSet (bits, XI_RawMotion);
+    if (on)
+	XISetMask (bits, XI_RawMotion);
+    else
+	XIClearMask (bits, XI_RawMotion);
 
-    constrainZoomTranslate ();
+    mask.deviceid = XIAllMasterDevices;
+    mask.mask_len = sizeof (bits);
+    mask.mask = bits;
+    XISelectEvents (screen->dpy (), screen->root (), &mask, 1);
+
+    return was;
 }
 
 /* Enables polling of mouse position, and refreshes currently
@@ -599,9 +2876,90 @@ EZoomScreen::panZoom (int xvalue, int yvalue)
 void
 EZoomScreen::enableMousePolling ()
 {
-    pollHandle.start ();
     lastChange = time(NULL);
     mouse = MousePoller::getCurrentPosition ();
+    lastMotion = monotonicMs ();
+
+    if (xi2Supported)
+    {
+	xi2OwnSelection = !selectRawMotion (true);
+	xi2Tracking = true;
+	return;
+    }
+
+    pollHandle.start ();
+    idleTimer.start (POINTER_IDLE_MS, POINTER_IDLE_MS * 1.2);
+}
+
+void
+EZoomScreen::disableMousePolling ()
+{
+    if (xi2Tracking)
+    {
+	/* Left alone if it was selected before we did */
+	if (xi2OwnSelection)
+	    selectRawMotion (false);
+	xi2Tracking = false;
+    }
+
+    motionTimer.stop ();
+    idleTimer.stop ();
+    if (pollHandle.active ())
+	pollHandle.stop ();
+}
+
+/* True while the pointer is tracked, one way or the other */
+bool
+EZoomScreen::mousePolling ()
+{
+    return xi2Tracking || pollHandle.active () || idleTimer.active ();
+}
+
+/* Where the pointer is now, for raw motion and idle polling */
+bool
+EZoomScreen::queryPointer ()
+{
+    Window	 root, child;
+    int		 x, y, winX, winY;
+    unsigned int state;
+
+    if (XQueryPointer (screen->dpy (), screen->root (), &root, &child,
+		       &x, &y, &winX, &winY, &state) &&
+	(x != mouse.x () || y != mouse.y ()))
+	updateMouseInterval (CompPoint (x, y));
+
+    return false;
+}
+
+/* See above. Runs every POINTER_IDLE_MS while mousepoll polls, and
+ * every POINTER_IDLE_POLL_MS after stopping it.  */
+bool
+EZoomScreen::checkIdle ()
+{
+    CompPoint old = mouse;
+
+    if (pollHandle.active ())
+    {
+	if (monotonicMs () - lastMotion < POINTER_IDLE_MS)
+	    return true;
+
+	pollHandle.stop ();
+	idleTimer.setTimes (POINTER_IDLE_POLL_MS, POINTER_IDLE_POLL_MS * 1.2);
+	return true;
+    }
+
+    queryPointer ();
+
+    if (!grabbed)
+	return false;
+
+    if (mouse != old)
+    {
+	pollHandle.start ();
+	idleTimer.setTimes (POINTER_IDLE_MS, POINTER_IDLE_MS * 1.2);
+    }
+
+    return true;
 }
 
 void
@@ -623,7 +2981,7 @@ EZoomScreen::setScale (int out, float value)
 	value = 1.0f;
     else
     {
-	if (!pollHandle.active ())
+	if (!mousePolling ())
 	    enableMousePolling ();
 	grabbed |= (1 << zooms.at (out).output);
 	cursorZoomActive (out);
@@ -640,7 +2998,59 @@ EZoomScreen::setScale (int out, float value)
 	value = optionGetMinimumZoom ();
 
     zooms.at (out).newZoom = value;
-    cScreen->damageScreen();
+    markMoving (out);
+    damageView ();
+}
+
+/* Zoom in (positive) or out (negative) by steps times zoom_factor.
+ * Input is only added up here, a whole burst of wheel notches or key
+ * repeats is applied once in preparePaint. The first step of a burst
+ * schedules that frame.  */
+void
+EZoomScreen::queueZoomSteps (float steps)
+{
+    int out = screen->outputDeviceForPoint (pointerX, pointerY);
+
+    if (pendingZoomSteps != 0.0f && out != pendingZoomOutput)
+	flushZoomInput ();
+
+    if (pendingZoomSteps == 0.0f)
+    {
+	toggleFunctions (true);
+	cScreen->damagePending ();
+    }
+
+    pendingZoomSteps += steps;
+    pendingZoomOutput = out;
+}
+
+/* Apply the zoom input gathered since the last frame in one go, so the
+ * X and GL side effects of setScale happen once per frame.  */
+void
+EZoomScreen::flushZoomInput ()
+{
+    int out = pendingZoomOutput;
+
+    if (pendingZoomSteps == 0.0f)
+	return;
+
+    /* Dropped, or the next input would never schedule a frame */
+    if (!outputIsZoomArea (out))
+    {
+	pendingZoomSteps = 0.0f;
+	return;
+    }
+
+    if (pendingZoomSteps > 0.0f &&
+	optionGetZoomMode () == EzoomOptions::ZoomModeSyncMouse &&
+	!isInMovement (out))
+	setCenter (pointerX, pointerY, true);
+
+    setScale (out,
+	      zooms[out].newZoom /
+	      pow (optionGetZoomFactor (), pendingZoomSteps));
+
+    pendingZoomSteps = 0.0f;
 }
 
 /* Sets the zoom factor to the bigger of the two floats supplied.
@@ -661,12 +3071,20 @@ setScaleBigger (int out, float x, float y)
 
 /* Syncs the center, based on translations, back to the mouse.
  * This should be called when doing non-IR zooming and moving the zoom
- * area based on events other than mouse movement.
+ * area based on events other than mouse movement. The warp is worked
+ * out by flushWarp, see syncWarpTarget.
  */
 void
 EZoomScreen::syncCenterToMouse ()
 {
-    int         x, y;
+    warpSync = true;
+    scheduleWarp ();
+}
+
+/* Where syncCenterToMouse puts the pointer. False if it stays.  */
+bool
+EZoomScreen::syncWarpTarget (int *x, int *y)
+{
     int         out;
     CompOutput  *o;
 
@@ -674,20 +3092,77 @@ EZoomScreen::syncCenterToMouse ()
     o = &screen->outputDevs ().at (out);
 
     if (!isInMovement (out))
-	return;
+	return false;
 
-    x = (int) ((zooms.at (out).realXTranslate * o->width ()) +
-	       (o->width () / 2) + o->x1 ());
-    y = (int) ((zooms.at (out).realYTranslate * o->height ()) +
-	       (o->height () / 2) + o->y1 ());
+    *x = (int) ((zooms.at (out).realXTranslate * o->width ()) +
+		(o->width () / 2) + o->x1 ());
+    *y = (int) ((zooms.at (out).realYTranslate * o->height ()) +
+		(o->height () / 2) + o->y1 ());
 
-    if ((x != mouse.x () || y != mouse.y ())
-	&& grabbed && zooms.at (out).newZoom != 1.0f)
+    return ((*x != mouse.x () || *y != mouse.y ()) &&
+	    grabbed && zooms.at (out).newZoom != 1.0f);
+}
+
+/* True if the output sits at a whole zoom level (2x, 3x, ...) and
+ * should be painted pixel exact.  */
+bool
+EZoomScreen::pixelExact (int out)
+{
+    float factor = 1.0f / zooms[out].currentZoom;
+
+    return (optionGetPixelExact () && factor > 1.5f &&
+	    fabs (factor - floor (factor + 0.5f)) < 0.001f);
+}
+
+/* The zoom and real translation that painting and the coordinate
+ * conversions work with. When pixelExact, the zoom is the exact
+ * reciprocal of the level and the translation is rounded so the output
+ * starts on a whole source pixel; each source pixel then covers whole
+ * output pixels and needs no filtering. With remote panning the
+ * translation is rounded to whole output pixels instead, so a pan
+ * shifts the view by whole pixels.  */
+void
+EZoomScreen::paintedView (int   out,
+			  float *zoom,
+			  float *xTranslate,
+			  float *yTranslate)
+{
+    CompOutput *o = &screen->outputDevs ()[out];
+    ZoomArea   &za = zooms[out];
+    float      z, unit, w, h, left, top;
+
+    *zoom = za.currentZoom;
+    *xTranslate = za.realXTranslate;
+    *yTranslate = za.realYTranslate;
+
+    if (pixelExact (out))
+    {
+	z = 1.0f / floor (1.0f / za.currentZoom + 0.5f);
+	unit = 1.0f;
+    }
+    else if (optionGetRemotePan () && za.currentZoom < 1.0f)
+    {
+	z = za.currentZoom;
+	unit = z;
+    }
+    else
     {
-	screen->warpPointer (x - pointerX , y - pointerY );
-	mouse.setX (x);
-	mouse.setY (y);
+	return;
     }
+
+    w = o->width ();
+    h = o->height ();
+
+    /* Offset of the top left source pixel from the output's corner, in
+     * whole units */
+    left = floor ((0.5f + za.realXTranslate) * (1.0f - z) * w / unit +
+		  0.5f) * unit;
+    top = floor ((0.5f + za.realYTranslate) * (1.0f - z) * h / unit +
+		 0.5f) * unit;
+
+    *zoom = z;
+    *xTranslate = left / ((1.0f - z) * w) - 0.5f;
+    *yTranslate = top / ((1.0f - z) * h) - 0.5f;
 }
 
 /* Convert the point X,Y to where it would be when zoomed.  */
@@ -707,22 +3182,90 @@ EZoomScreen::convertToZoomed (int        out,
     }
 
     o = &screen->outputDevs ()[out];
-    ZoomArea    &za = zooms.at (out);
+
+    float zoom, xTranslate, yTranslate;
+
+    paintedView (out, &zoom, &xTranslate, &yTranslate);
 
     x -= o->x1 ();
     y -= o->y1 ();
-    *resultX = x - (za.realXTranslate *
-		    (1.0f - za.currentZoom) * o->width ()) - o->width () / 2;
-    *resultX /= za.currentZoom;
+    *resultX = x - (xTranslate *
+		    (1.0f - zoom) * o->width ()) - o->width () / 2;
+    *resultX /= zoom;
     *resultX += o->width () / 2;
     *resultX += o->x1 ();
-    *resultY = y - (za.realYTranslate *
-		    (1.0f - za.currentZoom) * o->height ()) - o->height ()/ 2;
-    *resultY /= za.currentZoom;
+    *resultY = y - (yTranslate *
+		    (1.0f - zoom) * o->height ()) - o->height ()/ 2;
+    *resultY /= zoom;
     *resultY += o->height ()/ 2;
     *resultY += o->y1 ();
 }
 
+/* Convert the point X,Y on a zoomed output back to where it is on the
+ * unzoomed screen; the inverse of convertToZoomed.  */
+void
+EZoomScreen::convertToUnzoomed (int        out,
+			       int        x,
+			       int        y,
+			       int        *resultX,
+			       int        *resultY)
+{
+    CompOutput *o = &screen->outputDevs ()[out];
+    float      zoom, xTranslate, yTranslate;
+
+    paintedView (out, &zoom, &xTranslate, &yTranslate);
+
+    x -= o->x1 ();
+    y -= o->y1 ();
+    *resultX = (x - o->width () / 2) * zoom +
+	       xTranslate * (1.0f - zoom) * o->width () +
+	       o->width () / 2 + o->x1 ();
+    *resultY = (y - o->height () / 2) * zoom +
+	       yTranslate * (1.0f - zoom) * o->height () +
+	       o->height () / 2 + o->y1 ();
+}
+
+/* Where a region of the unzoomed screen shows up on the zoomed output,
+ * rounded outwards by a source pixel and clipped to the output.  */
+CompRegion
+EZoomScreen::zoomedRegion (int out, const CompRegion &region)
+{
+    CompOutput *o = &screen->outputDevs ()[out];
+    CompRegion result;
+    int        pad = ceil (1.0f / zooms[out].currentZoom);
+
+    foreach (const CompRect &r, region.rects ())
+    {
+	int x1, y1, x2, y2;
+
+	convertToZoomed (out, r.x1 (), r.y1 (), &x1, &y1);
+	convertToZoomed (out, r.x2 (), r.y2 (), &x2, &y2);
+	result += CompRect (x1 - pad, y1 - pad,
+			    x2 - x1 + 2 * pad, y2 - y1 + 2 * pad);
+    }
+
+    return result.intersected (*o);
+}
+
+/* The part of the unzoomed screen that is visible in a region of the
+ * zoomed output.  */
+CompRegion
+EZoomScreen::unzoomedRegion (int out, const CompRegion &region)
+{
+    CompRegion result;
+
+    foreach (const CompRect &r, region.rects ())
+    {
+	int x1, y1, x2, y2;
+
+	convertToUnzoomed (out, r.x1 (), r.y1 (), &x1, &y1);
+	convertToUnzoomed (out, r.x2 (), r.y2 (), &x2, &y2);
+	result += CompRect (x1 - 1, y1 - 1, x2 - x1 + 2, y2 - y1 + 2);
+    }
+
+    return result;
+}
+
 /* Same but use targeted translation, not real */
 void
 EZoomScreen::convertToZoomedTarget (int	  out,
@@ -795,7 +3338,7 @@ EZoomScreen::ensureVisibility (int x, int y, int margin)
 	    (FACTOR * (float) (zoomY - margin - o->y1 ())) /
 	    (float) o->height ();
 #undef FACTOR
-    constrainZoomTranslate ();
+    constrainZoomTranslate (out);
     return true;
 }
 
@@ -916,13 +3459,23 @@ EZoomScreen::ensureVisibilityArea (int         x1,
     return ;
 }
 
-/* Ensures that the cursor is visible on the given head.
+/* Ensures that the cursor is visible on the given head. The warp is
+ * worked out by flushWarp, see restrainWarpTarget.
+ */
+void
+EZoomScreen::restrainCursor (int out)
+{
+    warpRestrain = out;
+    scheduleWarp ();
+}
+
+/* Where restrainCursor puts the pointer. False if it stays.
  * Note that we check if currentZoom is 1.0f, because that often means that
  * mouseX and mouseY is not up-to-date (since the polling timer just
  * started).
  */
-void
-EZoomScreen::restrainCursor (int out)
+bool
+EZoomScreen::restrainWarpTarget (int out, int *x, int *y)
 {
     int         x1, y1, x2, y2, margin;
     int         diffX = 0, diffY = 0;
@@ -953,7 +3506,7 @@ EZoomScreen::restrainCursor (int out)
 
     if ((x2 - x1 > o->x2 () - o->x1 ()) ||
        (y2 - y1 > o->y2 () - o->y1 ()))
-	return;
+	return false;
     if (x2 > o->x2 () - margin && east > 0)
 	diffX = x2 - o->x2 () + margin;
     else if (x1 < o->x1 () + margin && west > 0)
@@ -964,11 +3517,10 @@ EZoomScreen::restrainCursor (int out)
     else if (y1 < o->y1 () + margin && north > 0)
 	diffY = y1 - o->y1 () - margin;
 
-    if (abs(diffX)*z > 0  || abs(diffY)*z > 0)
-	screen->warpPointer ((int) (mouse.x () - pointerX) -
-						       (int) ((float)diffX * z),
-		     	     (int) (mouse.y () - pointerY) -
-						      (int) ((float)diffY * z));
+    *x = mouse.x () - (int) ((float)diffX * z);
+    *y = mouse.y () - (int) ((float)diffY * z);
+
+    return (abs(diffX)*z > 0  || abs(diffY)*z > 0);
 }
 
 /* Check if the cursor is still visible.
@@ -985,7 +3537,9 @@ EZoomScreen::cursorMoved ()
     out = screen->outputDeviceForPoint (mouse.x (), mouse.y ());
     if (isActive (out))
     {
-	if (optionGetRestrainMouse ())
+	/* Edge Push pans from preparePaint instead of warping */
+	if (optionGetRestrainMouse () &&
+	    optionGetZoomMode () != EzoomOptions::ZoomModeEdgePush)
 	    restrainCursor (out);
 
 	if (optionGetZoomMode () == EzoomOptions::ZoomModePanArea)
@@ -1008,23 +3562,104 @@ EZoomScreen::cursorMoved ()
     }
 }
 
+/* Where drawCursor puts the scaled cursor on the zoomed outputs,
+ * rounded outwards. Empty if we are not drawing it.  */
+CompRegion
+EZoomScreen::cursorRegion ()
+{
+    CompRegion region;
+
+    if (!cursor.isSet)
+	return region;
+
+    for (unsigned int out = 0; out < zooms.size (); out++)
+    {
+	float scale;
+	int   x, y;
+
+	if (!isActive (out))
+	    continue;
+
+	if (optionGetScaleMouseDynamic ())
+	    scale = 1.0f / zooms[out].currentZoom;
+	else
+	    scale = 1.0f / optionGetScaleMouseStatic ();
+
+	convertToZoomed (out, mouse.x (), mouse.y (), &x, &y);
+	CompRegion part (x - cursor.hotX * scale - 1,
+			 y - cursor.hotY * scale - 1,
+			 cursor.width * scale + 2,
+			 cursor.height * scale + 2);
+
+	/* So is its cursor */
+	if (mirrorActive () && (int) out == optionGetMirrorSource ())
+	    part = mirrorRegion (part);
+	region += part;
+    }
+
+    return region;
+}
+
 /* Update the mouse position.
  * Based on the zoom engine in use, we will have to move the zoom area.
  * This might have to be added to a timer.
+ *
+ * If the view stays put only the scaled cursor moved, so only where it
+ * was and where it is now get repainted.
  */
 void
 EZoomScreen::updateMousePosition (const CompPoint &p)
 {
-    int out;
+    CompRegion damage = cursorRegion ();
+    bool       viewMoved, ownWarp;
+    int        out;
+
+    /* Where we warped to ourselves, see queueWarp. Only the first report
+     * after the warp can be it, whether or not the user moved since */
+    ownWarp = warpExpected && p == warpedTo;
+    warpExpected = false;
+
     mouse.setX (p.x ());
     mouse.setY (p.y ());
     out = screen->outputDeviceForPoint (mouse.x (), mouse.y ());
     lastChange = time(NULL);
-    if (optionGetZoomMode () == EzoomOptions::ZoomModeSyncMouse &&
-        !isInMovement (out))
-	setCenter (mouse.x (), mouse.y (), true);
-    cursorMoved ();
-    cScreen->damageScreen ();
+    if (!ownWarp)
+    {
+	if (optionGetZoomMode () == EzoomOptions::ZoomModeSyncMouse &&
+	    !isInMovement (out))
+	    setCenter (mouse.x (), mouse.y (), true);
+	cursorMoved ();
+    }
+
+    /* Remote panning damages the moving view from its timer */
+    viewMoved = !moving.empty () && !optionGetRemotePan ();
+    for (out = 0; out < (int) zooms.size () && !viewMoved; out++)
+	viewMoved = isActive (out) && zooms[out].viewChanged ();
+
+    /* Only the mirror target shows the scaled cursor */
+    if (mirrorActive () && !viewMoved)
+    {
+	damageZoomedRegion (
+		screen->outputDevs ()[optionGetMirrorTarget ()]);
+	return;
+    }
+
+    /* Only the lens shows the view */
+    if (optionGetLensShape () != EzoomOptions::LensShapeOff)
+    {
+	damageLens ();
+	viewMoved = false;
+    }
+
+    if (viewMoved)
+    {
+	damageView ();
+	return;
+    }
+
+    damage += cursorRegion ();
+    if (!damage.isEmpty ())
+	damageZoomedRegion (damage);
 }
 
 /* Timeout handler to poll the mouse. Returns false (and thereby does not
@@ -1033,12 +3668,12 @@ void
 EZoomScreen::updateMouseInterval (const CompPoint &p)
 {
     updateMousePosition (p);
+    lastMotion = monotonicMs ();
 
     if (!grabbed)
     {
 	cursorMoved ();
-	if (pollHandle.active ())
-	    pollHandle.stop ();
+	disableMousePolling ();
     }
 }
 
@@ -1049,8 +3684,8 @@ EZoomScreen::freeCursor (CursorTexture * cursor)
     if (!cursor->isSet)
 	return;
 
+    /* The texture belongs to cursorCache */
     cursor->isSet = false;
-    glDeleteTextures (1, &cursor->texture);
     cursor->texture = 0;
 }
 
@@ -1097,13 +3732,13 @@ EZoomScreen::drawCursor (CompOutput          *output,
 	glEnable (GL_TEXTURE_RECTANGLE_ARB);
 
 	glBegin (GL_QUADS);
-	glTexCoord2d (0, 0);
+	glTexCoord2d (cursor.x, cursor.y);
 	glVertex2f (x, y);
-	glTexCoord2d (0, cursor.height);
+	glTexCoord2d (cursor.x, cursor.y + cursor.height);
 	glVertex2f (x, y + cursor.height);
-	glTexCoord2d (cursor.width, cursor.height);
+	glTexCoord2d (cursor.x + cursor.width, cursor.y + cursor.height);
 	glVertex2f (x + cursor.width, y + cursor.height);
-	glTexCoord2d (cursor.width, 0);
+	glTexCoord2d (cursor.x + cursor.width, cursor.y);
 	glVertex2f (x + cursor.width, y);
 	glEnd ();
 	glDisable (GL_BLEND);
@@ -1113,91 +3748,383 @@ EZoomScreen::drawCursor (CompOutput          *output,
     }
 }
 
-/* Create (if necessary) a texture to store the cursor,
- * fetch the cursor with XFixes. Store it.  */
+#define CURSOR_CACHE_COLUMNS 4
+#define CURSOR_CACHE_ROWS    2
+
+EZoomScreen::CursorCache::CursorCache () :
+    texture (0),
+    slotSize (0),
+    clock (0),
+    tried (false),
+    pbo (0),
+    mapped (NULL)
+{
+}
+
+/* Look up the pixel buffer object entry points, once */
 void
-EZoomScreen::updateCursor (CursorTexture * cursor)
+EZoomScreen::CursorCache::init (GLScreen *gScreen)
 {
-    unsigned char *pixels;
-    int           i;
-    Display       *dpy = screen->dpy ();
+    const char *extensions;
 
-    if (!cursor->isSet)
-    {
-	cursor->isSet = true;
-	cursor->screen = screen;
-	glEnable (GL_TEXTURE_RECTANGLE_ARB);
-	glGenTextures (1, &cursor->texture);
-	glBindTexture (GL_TEXTURE_RECTANGLE_ARB, cursor->texture);
+    if (tried)
+	return;
 
-	glTexParameteri (GL_TEXTURE_RECTANGLE_ARB,
-			 GL_TEXTURE_WRAP_S, GL_CLAMP);
-	glTexParameteri (GL_TEXTURE_RECTANGLE_ARB,
-			 GL_TEXTURE_WRAP_T, GL_CLAMP);
-    } else {
-	glEnable (GL_TEXTURE_RECTANGLE_ARB);
+    tried = true;
+
+    extensions = (const char *) glGetString (GL_EXTENSIONS);
+    if (!extensions || !strstr (extensions, "GL_ARB_pixel_buffer_object"))
+	return;
+
+    genBuffers = (OverlayRenderer::GenBuffersProc)
+	gScreen->getProcAddress ("glGenBuffersARB");
+    deleteBuffers = (OverlayRenderer::DeleteBuffersProc)
+	gScreen->getProcAddress ("glDeleteBuffersARB");
+    bindBuffer = (OverlayRenderer::BindBufferProc)
+	gScreen->getProcAddress ("glBindBufferARB");
+    bufferData = (OverlayRenderer::BufferDataProc)
+	gScreen->getProcAddress ("glBufferDataARB");
+    mapBuffer = (MapBufferProc)
+	gScreen->getProcAddress ("glMapBufferARB");
+    unmapBuffer = (UnmapBufferProc)
+	gScreen->getProcAddress ("glUnmapBufferARB");
+
+    if (genBuffers && deleteBuffers && bindBuffer && bufferData &&
+	mapBuffer && unmapBuffer)
+	(*genBuffers) (1, &pbo);
+}
+
+/* Where to put the image for slot, with its border. Through the pixel
+ * buffer object the upload in endUpload only queues the copy; the
+ * buffer is orphaned first so we never wait for the previous one.  */
+uint32_t *
+EZoomScreen::CursorCache::beginUpload (int slot)
+{
+    GLsizeiptrARB size = (slots[slot].width + 2) *
+			 (slots[slot].height + 2) * sizeof (uint32_t);
+
+    mapped = NULL;
+
+    if (pbo)
+    {
+	(*bindBuffer) (GL_PIXEL_UNPACK_BUFFER_ARB, pbo);
+	(*bufferData) (GL_PIXEL_UNPACK_BUFFER_ARB, size, NULL,
+		       GL_STREAM_DRAW_ARB);
+	mapped = (uint32_t *) (*mapBuffer) (GL_PIXEL_UNPACK_BUFFER_ARB,
+					    GL_WRITE_ONLY_ARB);
+	(*bindBuffer) (GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+
+	if (mapped)
+	    return mapped;
     }
 
-    XFixesCursorImage *ci = XFixesGetCursorImage (dpy);
+    /* Only ever grows, so this does not allocate once warm */
+    staging.resize (size / sizeof (uint32_t));
+
+    return &staging[0];
+}
+
+void
+EZoomScreen::CursorCache::endUpload (int slot)
+{
+    const GLvoid *data = &staging[0];
+    int		 x, y;
 
-    if (ci)
+    slotOrigin (slot, &x, &y);
+
+    if (mapped)
     {
-	cursor->width = ci->width;
-	cursor->height = ci->height;
-	cursor->hotX = ci->xhot;
-	cursor->hotY = ci->yhot;
-	pixels = (unsigned char *) malloc (ci->width * ci->height * 4);
+	(*bindBuffer) (GL_PIXEL_UNPACK_BUFFER_ARB, pbo);
+	(*unmapBuffer) (GL_PIXEL_UNPACK_BUFFER_ARB);
+	data = NULL;
+    }
+
+    glBindTexture (GL_TEXTURE_RECTANGLE_ARB, texture);
+    glTexSubImage2D (GL_TEXTURE_RECTANGLE_ARB, 0, x - 1, y - 1,
+		     slots[slot].width + 2, slots[slot].height + 2, GL_BGRA,
+		     GL_UNSIGNED_INT_8_8_8_8_REV, data);
+    glBindTexture (GL_TEXTURE_RECTANGLE_ARB, 0);
+
+    if (mapped)
+	(*bindBuffer) (GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+    mapped = NULL;
+}
 
-	if (!pixels)
+/* True if a cursor this large fits the slots as they are */
+bool
+EZoomScreen::CursorCache::fits (int width, int height)
+{
+    return MAX (width, height) + 2 <= slotSize;
+}
+
+/* The slot holding the cursor with this serial, or -1 */
+int
+EZoomScreen::CursorCache::lookup (unsigned long serial)
+{
+    for (unsigned int i = 0; i < slots.size (); i++)
+    {
+	if (slots[i].lastUse && slots[i].serial == serial)
 	{
-	    XFree (ci);
-	    return;
+	    slots[i].lastUse = ++clock;
+	    return i;
 	}
+    }
+
+    return -1;
+}
+
+/* Take the least recently used slot for a cursor image and return
+ * it, or -1 if it does not fit in a texture. The image itself goes in
+ * with beginUpload and endUpload. A cursor larger than the slots so
+ * far rebuilds the texture with larger ones, which drops every cached
+ * cursor; rebuilt is set then, and whatever showed one of them has to
+ * look it up again. On failure the cache is left as it was.  */
+int
+EZoomScreen::CursorCache::store (unsigned long	     serial,
+				 int		     width,
+				 int		     height,
+				 int		     hotX,
+				 int		     hotY,
+				 bool		     *rebuilt)
+{
+    int size = MAX (width, height) + 2;
+    int slot = 0;
+
+    *rebuilt = false;
+
+    if (size > slotSize)
+    {
+	GLint max;
+	int   newSize;
+
+	glGetIntegerv (GL_MAX_RECTANGLE_TEXTURE_SIZE_ARB, &max);
 
-	for (i = 0; i < ci->width * ci->height; i++)
+	for (newSize = 64; newSize < size; newSize *= 2);
+
+	if (newSize * CURSOR_CACHE_COLUMNS > max)
 	{
-	    unsigned long pix = ci->pixels[i];
-	    pixels[i * 4] = pix & 0xff;
-	    pixels[(i * 4) + 1] = (pix >> 8) & 0xff;
-	    pixels[(i * 4) + 2] = (pix >> 16) & 0xff;
-	    pixels[(i * 4) + 3] = (pix >> 24) & 0xff;
+	    compLogMessage ("ezoom", CompLogLevelWarn,
+			    "cursor of %dx%d too large to zoom", width,
+			    height);
+	    return -1;
 	}
 
+	if (texture)
+	    glDeleteTextures (1, &texture);
+	texture = 0;
+	slots.clear ();
+	slotSize = newSize;
+	*rebuilt = true;
+
+	slots.resize (CURSOR_CACHE_COLUMNS * CURSOR_CACHE_ROWS);
+
+	glGenTextures (1, &texture);
+	glBindTexture (GL_TEXTURE_RECTANGLE_ARB, texture);
+	glTexParameteri (GL_TEXTURE_RECTANGLE_ARB,
+			 GL_TEXTURE_WRAP_S, GL_CLAMP);
+	glTexParameteri (GL_TEXTURE_RECTANGLE_ARB,
+			 GL_TEXTURE_WRAP_T, GL_CLAMP);
+	glTexImage2D (GL_TEXTURE_RECTANGLE_ARB, 0, GL_RGBA,
+		      slotSize * CURSOR_CACHE_COLUMNS,
+		      slotSize * CURSOR_CACHE_ROWS, 0, GL_BGRA,
+		      GL_UNSIGNED_BYTE, NULL);
+	glBindTexture (GL_TEXTURE_RECTANGLE_ARB, 0);
+    }
+
+    for (unsigned int i = 1; i < slots.size (); i++)
+	if (slots[i].lastUse < slots[slot].lastUse)
+	    slot = i;
+
+    slots[slot].serial = serial;
+    slots[slot].width = width;
+    slots[slot].height = height;
+    slots[slot].hotX = hotX;
+    slots[slot].hotY = hotY;
+    slots[slot].lastUse = ++clock;
+
+    return slot;
+}
+
+/* Where the image in slot starts in texture, inside its border */
+void
+EZoomScreen::CursorCache::slotOrigin (int slot, int *x, int *y)
+{
+    *x = (slot % CURSOR_CACHE_COLUMNS) * slotSize + 1;
+    *y = (slot / CURSOR_CACHE_COLUMNS) * slotSize + 1;
+}
+
+void
+EZoomScreen::CursorCache::fini ()
+{
+    if (texture)
+	glDeleteTextures (1, &texture);
+    if (pbo)
+	(*deleteBuffers) (1, &pbo);
+
+    texture = 0;
+    pbo = 0;
+    tried = false;
+    slotSize = 0;
+    slots.clear ();
+}
+
+/* Show the cursor in slot of cursorCache */
+void
+EZoomScreen::setCursor (CursorTexture * cursor, int slot)
+{
+    CursorCache::Entry &entry = cursorCache.slots[slot];
+
+    cursor->isSet = true;
+    cursor->screen = screen;
+    cursor->texture = cursorCache.texture;
+    cursor->width = entry.width;
+    cursor->height = entry.height;
+    cursor->hotX = entry.hotX;
+    cursor->hotY = entry.hotY;
+    cursorCache.slotOrigin (slot, &cursor->x, &cursor->y);
+}
+
+/* Show the cursor with this serial if it is cached. Returns false if
+ * it has to be fetched.  */
+bool
+EZoomScreen::cachedCursor (CursorTexture * cursor, unsigned long serial)
+{
+    int slot = cursorCache.lookup (serial);
+
+    if (slot < 0)
+	return false;
+
+    setCursor (cursor, slot);
+
+    return true;
+}
+
+/* Fetch the cursor with XFixes, store it in the cache and show it.  */
+void
+EZoomScreen::updateCursor (CursorTexture * cursor)
+{
+    /* Fallback R: 255 G: 255 B: 255 A: 0
+     * FIXME: Draw a cairo mouse cursor */
+    static const unsigned long fallback = 0x00ffffff;
+    int			       slot;
+    bool		       rebuilt;
+    Display		       *dpy = screen->dpy ();
+
+    XFixesCursorImage *ci = XFixesGetCursorImage (dpy);
+
+    cursorCache.init (gScreen);
+
+    if (!ci)
+    {
+	compLogMessage ("ezoom", CompLogLevelWarn, "unable to get system cursor image!");
+	slot = cursorCache.store (0, 1, 1, 0, 0, &rebuilt);
+	if (slot >= 0)
+	    packCursorImage (&fallback, 1, 1, cursorCache.beginUpload (slot));
+    }
+    else if (cachedCursor (cursor, ci->cursor_serial))
+    {
+	cursorWanted = ci->cursor_serial;
 	XFree (ci);
+	return;
     }
     else
     {
-	/* Fallback R: 255 G: 255 B: 255 A: 255
-	 * FIXME: Draw a cairo mouse cursor */
+	cursorWanted = ci->cursor_serial;
+	slot = cursorCache.store (ci->cursor_serial, ci->width, ci->height,
+				  ci->xhot, ci->yhot, &rebuilt);
+	if (slot >= 0)
+	    packCursorImage (ci->pixels, ci->width, ci->height,
+			     cursorCache.beginUpload (slot));
+	XFree (ci);
+    }
 
-	cursor->width = 1;
-	cursor->height = 1;
-	cursor->hotX = 0;
-	cursor->hotY = 0;
-	pixels = (unsigned char *) malloc (cursor->width * cursor->height * 4);
+    /* Even after a rebuild, as this is the cursor shown */
+    if (slot >= 0)
+    {
+	cursorCache.endUpload (slot);
+	setCursor (cursor, slot);
+    }
+}
 
-	if (!pixels)
-	    return;
+/* Ask for the image of the cursor with serial, without waiting for it.
+ * The current cursor stays up until collectCursor has the reply.  */
+void
+EZoomScreen::requestCursor (unsigned long serial)
+{
+    cursorWanted = serial;
+
+    if (cursorPending)
+	return;
+
+    /* Checked, so an error comes back to collectCursor instead of going
+     * to the error handler core has on the shared connection */
+    cursorCookie = xcb_xfixes_get_cursor_image (xcb);
+    cursorPending = true;
+    xcb_flush (xcb);
+
+    /* So there is a frame to collect it in */
+    damageZoomedRegion (cursorRegion ());
+}
+
+/* Show the cursor image asked for by requestCursor, if it came in.
+ * Never blocks. A reply for a cursor that was replaced meanwhile is
+ * only cached, and not even that if it needs larger slots, as the
+ * rebuild would drop the cursor shown; the one wanted now is asked for
+ * unless it is cached already, in which case CursorNotify has shown
+ * it.  */
+void
+EZoomScreen::collectCursor ()
+{
+    xcb_xfixes_get_cursor_image_reply_t *reply = NULL;
+    xcb_generic_error_t		       *error = NULL;
+    CompRegion			       damage;
+    int				       slot;
+    bool			       rebuilt;
+
+    if (!cursorPending ||
+	!xcb_poll_for_reply (xcb, cursorCookie.sequence, (void **) &reply,
+			     &error))
+	return;
+
+    cursorPending = false;
+
+    if (error)
+	free (error);
+
+    if (!reply)
+	return;
+
+    if (cursor.isSet)
+    {
+	bool wanted = reply->cursor_serial == cursorWanted;
+
+	damage = cursorRegion ();
 
-	for (i = 0; i < cursor->width * cursor->height; i++)
+	slot = -1;
+	if (wanted || cursorCache.fits (reply->width, reply->height))
+	    slot = cursorCache.store (reply->cursor_serial, reply->width,
+				      reply->height, reply->xhot,
+				      reply->yhot, &rebuilt);
+	if (slot >= 0)
 	{
-	    unsigned long pix = 0x00ffffff;
-	    pixels[i * 4] = pix & 0xff;
-	    pixels[(i * 4) + 1] = (pix >> 8) & 0xff;
-	    pixels[(i * 4) + 2] = (pix >> 16) & 0xff;
-	    pixels[(i * 4) + 3] = (pix >> 24) & 0xff;
+	    copyCursorImage (xcb_xfixes_get_cursor_image_cursor_image (reply),
+			     reply->width, reply->height,
+			     cursorCache.beginUpload (slot));
+	    cursorCache.endUpload (slot);
+	    /* A rebuild took the texture of the cursor shown, so show this
+	     * one until the wanted one comes in */
+	    if (wanted || rebuilt)
+		setCursor (&cursor, slot);
 	}
 
-	compLogMessage ("ezoom", CompLogLevelWarn, "unable to get system cursor image!");
+	damage += cursorRegion ();
+	damageZoomedRegion (damage);
+
+	if (!wanted && cursorCache.lookup (cursorWanted) < 0)
+	    requestCursor (cursorWanted);
     }
 
-    glBindTexture (GL_TEXTURE_RECTANGLE_ARB, cursor->texture);
-    glTexImage2D (GL_TEXTURE_RECTANGLE_ARB, 0, GL_RGBA, cursor->width,
-		  cursor->height, 0, GL_BGRA, GL_UNSIGNED_BYTE, pixels);
-    glBindTexture (GL_TEXTURE_RECTANGLE_ARB, 0);
-    glDisable (GL_TEXTURE_RECTANGLE_ARB);
-	
-    free (pixels);
+    free (reply);
 }
 
 /* We are no longer zooming the cursor, so display it.  */
@@ -1213,6 +4140,12 @@ EZoomScreen::cursorZoomInactive ()
 	XFixesSelectCursorInput (screen->dpy (), screen->root (), 0);
     }
 
+    if (cursorPending)
+    {
+	cursorPending = false;
+	xcb_discard_reply (xcb, cursorCookie.sequence);
+    }
+
     if (cursor.isSet)
     {
 	freeCursor (&cursor);
@@ -1253,6 +4186,10 @@ EZoomScreen::cursorZoomActive (int out)
 				 XFixesDisplayCursorNotifyMask);
 	updateCursor (&cursor);
     }
+    /* The presenter keeps their own cursor on the mirror source */
+    if (mirrorActive () && out == optionGetMirrorSource ())
+	return;
+
     if (canHideCursor && !cursorHidden &&
 	(optionGetHideOriginalMouse () ||
 	 zooms.at (out).locked))
@@ -1377,6 +4314,7 @@ EZoomScreen::zoomBoxActivate (CompAction         *action,
     clickPos.setX (pointerX);
     clickPos.setY (pointerY);
     box.setGeometry (pointerX, pointerY, 0, 0);
+    damageZoomedRegion (boxRegion ());
     if (state & CompAction::StateInitButton)
         action->setState (action->state () | CompAction::StateTermButton);
 
@@ -1396,6 +4334,7 @@ EZoomScreen::zoomBoxDeactivate (CompAction         *action,
 	int	   x, y, width, height;
         CompOutput *o;
 
+	damageZoomedRegion (boxRegion ());
         screen->removeGrab (grabIndex, NULL);
         grabIndex = 0;
 
@@ -1439,23 +4378,16 @@ EZoomScreen::zoomBoxDeactivate (CompAction         *action,
 }
 
 /* Zoom in to the area pointed to by the mouse.
+ * float:delta: number of zoom steps, fractional for high resolution
+ *              scrolling (default: 1)
  */
 bool
 EZoomScreen::zoomIn (CompAction         *action,
 		    CompAction::State  state,
 		    CompOption::Vector options)
 {
-    int out = screen->outputDeviceForPoint (pointerX, pointerY);
-
-    if (optionGetZoomMode () == EzoomOptions::ZoomModeSyncMouse &&
-	!isInMovement (out))
-        setCenter (pointerX, pointerY, true);
-
-    setScale (out,
-	      zooms.at (out).newZoom /
-	      optionGetZoomFactor ());
-
-    toggleFunctions (true);
+    queueZoomSteps (CompOption::getFloatOptionNamed (options, "delta",
+						     1.0f));
 
     return true;
 }
@@ -1510,6 +4442,8 @@ EZoomScreen::zoomSpecific (CompAction         *action,
         setCenter (x, y, false);
     }
 
+    planFlight (out);
+
     toggleFunctions (true);
 
     return true;
@@ -1541,23 +4475,55 @@ EZoomScreen::zoomToWindow (CompAction         *action,
     setScaleBigger (out, (float) width/o->width (),
 		    (float) height/o->height ());
     areaToWindow (w);
+    planFlight (out);
     toggleFunctions (true);
 
     return true;
 }
 
+/* Pan on a pan key. With continuous panning the key is only marked as
+ * held here and preparePaint does the moving until it is released.  */
 bool
 EZoomScreen::zoomPan (CompAction         *action,
 		     CompAction::State  state,
 		     CompOption::Vector options,
 		     float		horizAmount,
-		     float		vertAmount)
+		     float		vertAmount,
+		     PanKey		key)
 {
-    panZoom (horizAmount, vertAmount);
+    if (!optionGetContinuousPan ())
+    {
+	panZoom (horizAmount, vertAmount);
+
+	return true;
+    }
+
+    if (state & CompAction::StateInitKey)
+	action->setState (action->state () | CompAction::StateTermKey);
+
+    if (!(panKeys & key))
+    {
+	panKeys |= key;
+	toggleFunctions (true);
+	damageView ();
+    }
 
     return true;
 }
 
+bool
+EZoomScreen::zoomPanTerminate (CompAction         *action,
+			      CompAction::State  state,
+			      CompOption::Vector options,
+			      PanKey		 key)
+{
+    panKeys &= ~key;
+
+    action->setState (action->state () & ~CompAction::StateTermKey);
+
+    return false;
+}
+
 /* Centers the mouse based on zoom level and translation.
  */
 bool
@@ -1566,17 +4532,14 @@ EZoomScreen::zoomCenterMouse (CompAction         *action,
 			     CompOption::Vector options)
 {
     int        out;
-
+    CompOutput *o;
 
     out = screen->outputDeviceForPoint (pointerX, pointerY);
-    screen->warpPointer ((int) (screen->outputDevs ().at (out).width ()/2 +
-			screen->outputDevs ().at (out).x1 () - pointerX)
-			 + ((float) screen->outputDevs ().at (out).width () *
-				-zooms.at (out).xtrans),
-			 (int) (screen->outputDevs ().at (out).height ()/2 +
-				screen->outputDevs ().at (out).y1 () - pointerY)
-			 + ((float) screen->outputDevs ().at (out).height () *
-				zooms.at (out).ytrans));
+    o = &screen->outputDevs ().at (out);
+    queueWarp ((int) (o->width () / 2 + o->x1 () -
+		      (float) o->width () * zooms.at (out).xtrans),
+	       (int) (o->height () / 2 + o->y1 () +
+		      (float) o->height () * zooms.at (out).ytrans));
     return true;
 }
 
@@ -1650,18 +4613,14 @@ EZoomScreen::initiate (CompAction         *action,
     return true;
 }
 
+/* float:delta: as for zoomIn */
 bool
 EZoomScreen::zoomOut (CompAction         *action,
 		     CompAction::State  state,
 		     CompOption::Vector options)
 {
-    int out = screen->outputDeviceForPoint (pointerX, pointerY);
-
-    setScale (out,
-	      zooms.at (out).newZoom *
-	      optionGetZoomFactor ());
-
-    toggleFunctions (true);
+    queueZoomSteps (-CompOption::getFloatOptionNamed (options, "delta",
+						      1.0f));
 
     return true;
 }
@@ -1678,7 +4637,8 @@ EZoomScreen::terminate (CompAction         *action,
     if (grabbed)
     {
         zooms.at (out).newZoom = 1.0f;
-        cScreen->damageScreen ();
+	markMoving (out);
+	damageView ();
     }
 
     toggleFunctions (true);
@@ -1742,6 +4702,7 @@ EZoomScreen::focusTrack (XEvent *event)
     }
 
     areaToWindow (w);
+    planFlight (out);
 
     toggleFunctions (true);
 }
@@ -1756,6 +4717,9 @@ EZoomScreen::handleEvent (XEvent *event)
 	case MotionNotify:
 	    if (grabIndex)
 	    {
+		/* Only the box changed: repaint where it was and is */
+		CompRegion damage = boxRegion ();
+
 	        if (pointerX < clickPos.x ())
 	        {
 		    box.setX (pointerX);
@@ -1775,7 +4739,9 @@ EZoomScreen::handleEvent (XEvent *event)
 	        {
 		    box.setHeight (pointerY - clickPos.y ());
 	        }
-	        cScreen->damageScreen ();
+
+		damage += boxRegion ();
+		damageZoomedRegion (damage);
 	    }
 	    break;
 
@@ -1783,13 +4749,31 @@ EZoomScreen::handleEvent (XEvent *event)
 	case MapNotify:
 	    focusTrack (event);
 	    break;
+	case GenericEvent:
+	    /* Coalesced, see queryPointer. The event data is not needed */
+	    if (xi2Tracking && event->xcookie.extension == xiOpcode &&
+		event->xcookie.evtype == XI_RawMotion &&
+		!motionTimer.active ())
+		motionTimer.start (0, 0);
+	    break;
 	default:
 	    if (event->type == fixesEventBase + XFixesCursorNotify)
 	    {
-		//XFixesCursorNotifyEvent *cev = (XFixesCursorNotifyEvent *)
-		    //event;
-		    if (cursor.isSet)
-			updateCursor (&cursor);
+		XFixesCursorNotifyEvent *cev = (XFixesCursorNotifyEvent *)
+		    event;
+
+		/* Switching back to a cursor we have seen costs nothing,
+		 * anything else is fetched without blocking */
+		if (cursor.isSet)
+		{
+		    CompRegion damage = cursorRegion ();
+
+		    cursorWanted = cev->cursor_serial;
+		    if (cachedCursor (&cursor, cev->cursor_serial))
+			damageZoomedRegion (damage + cursorRegion ());
+		    else
+			requestCursor (cev->cursor_serial);
+		}
 	    }
 	    break;
     }
@@ -1853,10 +4837,82 @@ EZoomScreen::handleAccessibilityEvent (AccessibilityEvent *event)
     }
 }
 
+EZoomWindow::EZoomWindow (CompWindow *w) :
+    PluginClassHandler <EZoomWindow, CompWindow> (w),
+    window (w),
+    gWindow (GLWindow::get (w)),
+    culled (false)
+{
+    GLWindowInterface::setHandler (gWindow,
+				   EZoomScreen::get (screen)->functionsEnabled);
+}
+
+/* Skip windows cullWindows found to be out of sight */
+bool
+EZoomWindow::glPaint (const GLWindowPaintAttrib &attrib,
+		      const GLMatrix		&transform,
+		      const CompRegion		&region,
+		      unsigned int		mask)
+{
+    ZOOM_SCREEN (screen);
+
+    if (zs->culling && culled)
+	return false;
+
+    return gWindow->glPaint (attrib, transform, region, mask);
+}
+
+/* Add the color filter to windows painted on a zoomed output, unless
+ * the output is drawn from the scene cache, which is filtered as a
+ * whole. Without it the desktop background stays unfiltered, see also
+ * windowFilterActive.  */
+void
+EZoomWindow::glDrawTexture (GLTexture	       *texture,
+			    GLFragment::Attrib &attrib,
+			    unsigned int       mask)
+{
+    ZOOM_SCREEN (screen);
+
+    if (zs->filtering)
+    {
+	GLFragment::Attrib     fa (attrib);
+	GLFragment::FunctionId id;
+	int		       target, param;
+	float		       texelX = 1.0f, texelY = 1.0f;
+
+	if (texture->target () == GL_TEXTURE_2D)
+	{
+	    target = COMP_FETCH_TARGET_2D;
+	    texelX = fabs (texture->matrix ().xx);
+	    texelY = fabs (texture->matrix ().yy);
+	}
+	else
+	{
+	    target = COMP_FETCH_TARGET_RECT;
+	}
+
+	param = fa.allocParameters (1);
+	id = zs->filterFunction (target, param);
+	if (id)
+	{
+	    (*GL::programEnvParameter4f) (GL_FRAGMENT_PROGRAM_ARB, param,
+					  texelX, texelY, 0.0f, 0.0f);
+	    fa.addFunction (id);
+	    gWindow->glDrawTexture (texture, fa, mask);
+	    return;
+	}
+    }
+
+    gWindow->glDrawTexture (texture, attrib, mask);
+}
+
 /* TODO: Use this ctor carefully */
 
 EZoomScreen::CursorTexture::CursorTexture () :
-    isSet (false)
+    isSet (false),
+    texture (0),
+    x (0),
+    y (0)
 {
 }
 
@@ -1871,18 +4927,20 @@ EZoomScreen::postLoad ()
 
     toggleFunctions (true);
 
-    if (!pollHandle.active ())
+    if (!mousePolling ())
 	enableMousePolling ();
 
-    foreach (ZoomArea &za, zooms)
+    for (unsigned int out = 0; out < zooms.size (); out++)
     {
-	grabbed |= (1 << za.output);
+	grabbed |= (1 << zooms[out].output);
+	zooms[out].queued = false;
+	markMoving (out);
     }
 
     cursorZoomActive (out);
     updateCursor (&cursor);
 
-    cScreen->damageScreen ();
+    damageView ();
 
 }
 
@@ -1894,14 +4952,54 @@ EZoomScreen::EZoomScreen (CompScreen *screen) :
     grabbed (0),
     grabIndex (0),
     lastChange (0),
+    lastPresentation (0.0),
+    lastPredicted (0.0),
+    refreshInterval (cScreen->optimalRedrawTime ()),
     cursorInfoSelected (false),
-    cursorHidden (false)
+    cursorHidden (false),
+    panKeys (0),
+    panSpeed (0.0f),
+    panXDirection (0.0f),
+    panYDirection (0.0f),
+    edgePushing (false),
+    damagingZoomed (false),
+    functionsEnabled (false),
+    culling (false),
+    pendingZoomSteps (0.0f),
+    pendingZoomOutput (0),
+    sceneFbo (0),
+    sceneTexture (0),
+    sceneTarget (GL_TEXTURE_2D),
+    sceneWidth (0),
+    sceneHeight (0),
+    filtering (false),
+    sceneFilterProgram (0),
+    sceneFilterBroken (false),
+    ownFullDamage (false),
+    drawingMirror (false),
+    mirrorDrawn (false),
+    softwareGL (-1),
+    windowPos2i (NULL),
+    lastRemoteStep (0.0),
+    xcb (XGetXCBConnection (screen->dpy ())),
+    cursorPending (false),
+    cursorWanted (0),
+    xi2Supported (false),
+    xiOpcode (0),
+    xi2Tracking (false),
+    xi2OwnSelection (false),
+    lastMotion (0.0),
+    warpPending (false),
+    warpSync (false),
+    warpRestrain (-1),
+    warpExpected (false)
 {
     ScreenInterface::setHandler (screen, false);
     CompositeScreenInterface::setHandler (cScreen, false);
     GLScreenInterface::setHandler (gScreen, false);
 
     int major, minor;
+    int xiEvent, xiError;
     unsigned int n;
     fixesSupported =
 	XFixesQueryExtension(screen->dpy (),
@@ -1915,6 +5013,26 @@ EZoomScreen::EZoomScreen (CompScreen *screen) :
     else
 	canHideCursor = false;
 
+    /* Raw motion needs XInput 2.1, see enableMousePolling. The server
+     * answers with what it has if that is less. A client announces one
+     * version only: if something else on core's connection announced
+     * another, this fails with BadValue, raw motion behaves as that
+     * version says, and we poll instead. The error is caught here so
+     * that it does not turn up in someone else's check.  */
+    if (XQueryExtension (screen->dpy (), "XInputExtension", &xiOpcode,
+			 &xiEvent, &xiError))
+    {
+	Status status;
+
+	major = 2;
+	minor = 1;
+	screen->checkForError (screen->dpy ());
+	status = XIQueryVersion (screen->dpy (), &major, &minor);
+	xi2Supported = screen->checkForError (screen->dpy ()) == Success &&
+		       status == Success &&
+		       (major > 2 || (major == 2 && minor >= 1));
+    }
+
     n = screen->outputDevs ().size ();
 
     for (unsigned int i = 0; i < n; i++)
@@ -1955,13 +5073,21 @@ EZoomScreen::EZoomScreen (CompScreen *screen) :
 						    optionGetZoomSpec3 ()));
 
     optionSetPanLeftKeyInitiate (boost::bind (&EZoomScreen::zoomPan, this, _1,
-					      _2, _3, -1, 0));
+					      _2, _3, -1, 0, PAN_LEFT));
     optionSetPanRightKeyInitiate (boost::bind (&EZoomScreen::zoomPan, this, _1,
-					        _2, _3, 1, 0));
+						_2, _3, 1, 0, PAN_RIGHT));
     optionSetPanUpKeyInitiate (boost::bind (&EZoomScreen::zoomPan, this, _1, _2,
-					     _3, 0, -1));
+					     _3, 0, -1, PAN_UP));
     optionSetPanDownKeyInitiate (boost::bind (&EZoomScreen::zoomPan, this, _1,
-					       _2, _3, 0, 1));
+					       _2, _3, 0, 1, PAN_DOWN));
+    optionSetPanLeftKeyTerminate (boost::bind (&EZoomScreen::zoomPanTerminate,
+					       this, _1, _2, _3, PAN_LEFT));
+    optionSetPanRightKeyTerminate (boost::bind (&EZoomScreen::zoomPanTerminate,
+						this, _1, _2, _3, PAN_RIGHT));
+    optionSetPanUpKeyTerminate (boost::bind (&EZoomScreen::zoomPanTerminate,
+					     this, _1, _2, _3, PAN_UP));
+    optionSetPanDownKeyTerminate (boost::bind (&EZoomScreen::zoomPanTerminate,
+					       this, _1, _2, _3, PAN_DOWN));
 
     optionSetFitToWindowKeyInitiate (boost::bind (&EZoomScreen::zoomToWindow,
 						  this, _1, _2, _3));
@@ -1986,14 +5112,28 @@ EZoomScreen::EZoomScreen (CompScreen *screen) :
 					&EZoomScreen::ensureVisibilityAction, this,
 					_1, _2, _3));
 
+    remoteTimer.setCallback (boost::bind (&EZoomScreen::remotePanTimeout,
+					  this));
+    motionTimer.setCallback (boost::bind (&EZoomScreen::queryPointer, this));
+    idleTimer.setCallback (boost::bind (&EZoomScreen::checkIdle, this));
+    warpTimer.setCallback (boost::bind (&EZoomScreen::flushWarp, this));
+
+    optionSetColorFilterNotify (boost::bind (
+				&EZoomScreen::colorFilterChanged, this, _1, _2));
+    optionSetFilterContrastNotify (boost::bind (
+				&EZoomScreen::colorFilterChanged, this, _1, _2));
+    optionSetFilterGammaNotify (boost::bind (
+				&EZoomScreen::colorFilterChanged, this, _1, _2));
+    optionSetFilterEdgeAmountNotify (boost::bind (
+				&EZoomScreen::colorFilterChanged, this, _1, _2));
+
 }
 
 EZoomScreen::~EZoomScreen ()
 {
     writeSerializedData ();
 
-    if (pollHandle.active ())
-	pollHandle.stop ();
+    disableMousePolling ();
 
     if (a11yHandle->active ())
     a11yHandle->unregisterAll ();
@@ -2001,8 +5141,14 @@ EZoomScreen::~EZoomScreen ()
     if (zooms.size ())
 	zooms.clear ();
 
+    freeSceneCache ();
+    overlays.fini ();
+    lensCopy.fini ();
+    mirrorCopy.fini ();
+
     cScreen->damageScreen ();
     cursorZoomInactive ();
+    cursorCache.fini ();
 }
 
 bool
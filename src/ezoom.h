@@ -46,10 +46,19 @@
 #include <mousepoll/mousepoll.h>
 #include <accessibility/accessibility.h>
 
+#include <X11/Xlib-xcb.h>
+#include <xcb/xcbext.h>
+#include <xcb/xfixes.h>
+#include <X11/extensions/XInput2.h>
+
 
 #include "ezoom_options.h"
+#include "scaler.h"
+#include "spring.h"
 
 #include <cmath>
+#include <ctime>
+#include <map>
 
 class EZoomScreen :
     public PluginClassHandler <EZoomScreen, CompScreen>,
@@ -86,6 +95,15 @@ class EZoomScreen :
 	    WEST
 	} ZoomEdge;
 
+	typedef enum {
+	    PAN_LEFT  = (1 << 0),
+	    PAN_RIGHT = (1 << 1),
+	    PAN_UP    = (1 << 2),
+	    PAN_DOWN  = (1 << 3)
+	} PanKey;
+
+	typedef void (*WindowPos2iProc) (GLint, GLint);
+
 	class CursorTexture
 	{
 	    public:
@@ -96,10 +114,178 @@ class EZoomScreen :
 		int        height;
 		int        hotX;
 		int        hotY;
+		int        x; // of the image in texture
+		int        y;
 	    public:
 		CursorTexture ();
 	};
 
+	/* Draws the scaled cursor and the zoom box of an output from one
+	 * vertex buffer with one draw call. A fragment program picks the
+	 * texel or the vertex color per vertex, by texcoord.z.
+	 */
+	class OverlayRenderer
+	{
+	    public:
+		typedef void (*GenBuffersProc) (GLsizei, GLuint *);
+		typedef void (*DeleteBuffersProc) (GLsizei, const GLuint *);
+		typedef void (*BindBufferProc) (GLenum, GLuint);
+		typedef void (*BufferDataProc) (GLenum, GLsizeiptrARB,
+						const GLvoid *, GLenum);
+		typedef void (*BufferSubDataProc) (GLenum, GLintptrARB,
+						   GLsizeiptrARB,
+						   const GLvoid *);
+
+		bool		     tried;
+		GLuint		     buffer;
+		GLuint		     program;
+		GLsizeiptrARB	     capacity; // bytes allocated in buffer
+		std::vector<GLfloat> vertices; // x, y, s, t, z, r, g, b, a
+
+		GenBuffersProc	     genBuffers;
+		DeleteBuffersProc    deleteBuffers;
+		BindBufferProc	     bindBuffer;
+		BufferDataProc	     bufferData;
+		BufferSubDataProc    bufferSubData;
+	    public:
+		OverlayRenderer ();
+
+		bool
+		init (GLScreen *gScreen);
+
+		void
+		fini ();
+
+		void
+		addQuad (float x1, float y1, float x2, float y2,
+			 float s1, float t1, float s2, float t2,
+			 bool textured, const GLushort color[4]);
+
+		void
+		draw (const GLMatrix &transform, GLuint texture);
+	};
+
+	/* Cursor images by XFixes cursor serial, the least recently used
+	 * one goes when all slots are taken. The images share one texture
+	 * in fixed size slots, each with a transparent border so filtering
+	 * does not bleed between them. Images are packed into staging, or
+	 * straight into a pixel buffer object when there is one so the
+	 * upload does not wait for the GPU.
+	 */
+	class CursorCache
+	{
+	    public:
+		typedef void *(*MapBufferProc) (GLenum, GLenum);
+		typedef GLboolean (*UnmapBufferProc) (GLenum);
+
+		class Entry
+		{
+		    public:
+			unsigned long serial;
+			int           width;
+			int           height;
+			int           hotX;
+			int           hotY;
+			unsigned int  lastUse; // 0 if the slot is free
+		};
+
+		GLuint			texture;
+		int			slotSize; // including the border
+		unsigned int		clock;
+		std::vector <Entry>	slots;
+		std::vector <uint32_t>	staging;
+		bool			tried;
+		GLuint			pbo;
+		uint32_t		*mapped; // between begin and endUpload
+
+		OverlayRenderer::GenBuffersProc    genBuffers;
+		OverlayRenderer::DeleteBuffersProc deleteBuffers;
+		OverlayRenderer::BindBufferProc    bindBuffer;
+		OverlayRenderer::BufferDataProc    bufferData;
+		MapBufferProc			   mapBuffer;
+		UnmapBufferProc			   unmapBuffer;
+	    public:
+		CursorCache ();
+
+		void
+		init (GLScreen *gScreen);
+
+		int
+		lookup (unsigned long serial);
+
+		bool
+		fits (int width, int height);
+
+		int
+		store (unsigned long serial,
+		       int	     width,
+		       int	     height,
+		       int	     hotX,
+		       int	     hotY,
+		       bool	     *rebuilt);
+
+		uint32_t *
+		beginUpload (int slot);
+
+		void
+		endUpload (int slot);
+
+		void
+		slotOrigin (int slot, int *x, int *y);
+
+		void
+		fini ();
+	};
+
+	/* A texture holding a copy of part of what was just painted */
+	class FrameCopy
+	{
+	    public:
+		GLuint texture;
+		GLenum target;
+		int    width;
+		int    height;
+	    public:
+		FrameCopy ();
+
+		void
+		copy (const CompRect &rect);
+
+		void
+		fini ();
+	};
+
+	/* A planned "zoom out, pan, zoom in" path between two views, after
+	 * van Wijk and Nuij, "Smooth and efficient zooming and panning".
+	 * Views are a center and a width, in pixels of the output. length
+	 * is the length of the path, duration how long it takes in ms.
+	 */
+	class ZoomFlight
+	{
+	    public:
+		bool   active;
+		float  duration;
+		double length;
+		double x0, y0;
+		double dirX, dirY;
+		double distance;
+		double w0, w1;
+		double r0;
+		GLfloat toZoom;
+		GLfloat toXTranslate;
+		GLfloat toYTranslate;
+	    public:
+
+		ZoomFlight ();
+
+		void
+		plan (double fromX, double fromY, double fromW,
+		      double toX, double toY, double toW);
+
+		void
+		evaluate (float t, double &x, double &y, double &w);
+	};
+
 	/* Stores an actual zoom-setup. This can later be used to store/restore
 	 * zoom areas on the fly.
 	 *
@@ -113,6 +299,18 @@ class EZoomScreen :
 	 * [xyz]trans should never be modified except in updateActualTranslates()
 	 *
 	 * viewport is a mask of the viewport, or ~0 for "any".
+	 *
+	 * start* and target* record where the current motion started and
+	 * what it was heading for, elapsed is how long it has been going
+	 * in ms. A change of target restarts the motion.
+	 *
+	 * queued is true while the area is on the motion worklist.
+	 *
+	 * flight is the path taken instead of the motion profile for a
+	 * long jump, it is dropped if the target changes.
+	 *
+	 * painted* is the view as it was last painted, a region-only paint
+	 * is only possible when it has not changed since.
 	 */
 	class ZoomArea
 	{
@@ -150,6 +348,20 @@ class EZoomScreen :
 		GLfloat           xtrans;
 		GLfloat           ytrans;
 		bool              locked;
+		GLfloat           startZoom;
+		GLfloat           startXTranslate;
+		GLfloat           startYTranslate;
+		GLfloat           targetZoom;
+		GLfloat           targetXTranslate;
+		GLfloat           targetYTranslate;
+		float             elapsed;
+		bool              queued;
+		ZoomFlight        flight;
+		GLfloat           paintedZoom;
+		GLfloat           paintedXTrans;
+		GLfloat           paintedYTrans;
+		bool              sceneCached;
+		CompRegion        sceneDamage; // not yet in the scene cache
 	    public:
 
 		ZoomArea (int out);
@@ -157,6 +369,56 @@ class EZoomScreen :
 
 		void
 		updateActualTranslates ();
+
+		bool
+		targetChanged ();
+
+		void
+		startMotion ();
+
+		void
+		finishMotion ();
+
+		bool
+		viewChanged ();
+
+		void
+		viewPainted ();
+	};
+
+	/* Structure-of-arrays copy of the animated values of the zoom
+	 * areas on the motion worklist, so a frame steps them all in one
+	 * pass over contiguous arrays. Three lanes per output: zoom, x
+	 * and y.
+	 */
+	class MotionLanes
+	{
+	    public:
+		std::vector <GLfloat> position;
+		std::vector <GLfloat> velocity;
+		std::vector <GLfloat> target;
+		std::vector <GLfloat> start;
+		std::vector <GLfloat> decay;
+		std::vector <float>   dt;
+		std::vector <float>   elapsed;
+		SpringCoefficients    spring;
+		unsigned int          count;
+	    public:
+
+		MotionLanes () : count (0) {}
+
+		void
+		resize (unsigned int n);
+
+		void
+		set (unsigned int i,
+		     GLfloat      p,
+		     GLfloat      v,
+		     GLfloat      t,
+		     GLfloat      s,
+		     GLfloat      d,
+		     float        ms,
+		     float        e);
 	};
 
     public:
@@ -171,17 +433,75 @@ class EZoomScreen :
 
 	std::vector <ZoomArea>   zooms; // list of zooms (different zooms for
 					// each output
+	std::vector <int>	 moving; // worklist of outputs in motion
+	MotionLanes		 lanes;
 	CompPoint		 mouse; // we get this from mousepoll
 	unsigned long int	 grabbed;
 	CompScreen::GrabHandle   grabIndex; // for zoomBox
 	time_t			 lastChange;
+	double			 lastPresentation; // monotonic ms of the last
+	double			 lastPredicted;	   // frame shown, and of the one
+	float			 refreshInterval;  // we last animated for
 	CursorTexture		 cursor; // the texture for the faux-cursor
 					 // we paint to do fake input
 					 // handling
+	CursorCache		 cursorCache;
 	bool			 cursorInfoSelected;
 	bool			 cursorHidden;
 	CompRect		 box;
 	CompPoint	         clickPos;
+	unsigned int		 panKeys; // PanKey mask of held pan keys
+	float			 panSpeed;
+	float			 panXDirection;
+	float			 panYDirection;
+	bool			 edgePushing;
+	bool			 damagingZoomed; // damage is already zoomed
+	bool			 functionsEnabled;
+	bool			 culling; // windows are being culled
+	float			 pendingZoomSteps; // zoom in/out steps to apply
+	int			 pendingZoomOutput; // on the next frame
+	GLuint			 sceneFbo; // offscreen copy of the unzoomed
+	GLuint			 sceneTexture; // screen, see paintFromScene
+	GLenum			 sceneTarget;
+	int			 sceneWidth;
+	int			 sceneHeight;
+	OverlayRenderer		 overlays;
+	bool			 filtering; // windows get the color filter
+	GLuint			 sceneFilterProgram;
+	bool			 sceneFilterBroken;
+	bool			 ownFullDamage; // see damageView
+	FrameCopy		 lensCopy; // what the lens shows
+	FrameCopy		 mirrorCopy; // what the mirror shows
+	CompRect		 mirrorRect; // where mirrorCopy is from
+	bool			 drawingMirror;
+	bool			 mirrorDrawn; // this frame, see paintMirror
+	CompRegion		 lastLens; // as of the last damageLens
+	std::map <int, GLFragment::FunctionId> filterFunctions;
+	int			 softwareGL; // -1 until the renderer is known
+	WindowPos2iProc		 windowPos2i;
+	ImageScaler		 scaler; // see paintSoftware
+	std::vector <uint32_t>	 softwareSource;
+	std::vector <uint32_t>	 softwareScaled;
+	CompTimer		 remoteTimer; // paces remote panning
+	double			 lastRemoteStep;
+	xcb_connection_t	 *xcb; // for cursor images, see requestCursor
+	bool			 cursorPending;
+	xcb_xfixes_get_cursor_image_cookie_t cursorCookie;
+	unsigned long		 cursorWanted; // serial of the latest cursor
+	bool			 xi2Supported; // track raw motion instead
+	int			 xiOpcode;     // of polling, if the server
+	bool			 xi2Tracking;  // has XInput 2.1
+	bool			 xi2OwnSelection; // we selected raw motion
+	CompTimer		 motionTimer; // one query per burst of motion
+	CompTimer		 idleTimer; // stops polling while still
+	double			 lastMotion;
+	bool			 warpPending; // see queueWarp
+	bool			 warpSync; // see syncCenterToMouse
+	int			 warpRestrain; // output, or -1
+	bool			 warpExpected;
+	CompPoint		 warpTarget;
+	CompPoint		 warpedTo; // where the last flushWarp went
+	CompTimer		 warpTimer;
 
 	MousePoller		 pollHandle; // mouse poller object
 
@@ -212,6 +532,9 @@ class EZoomScreen :
 	void
 	donePaint ();
 
+	void
+	damageRegion (const CompRegion &);
+
 	void
 	handleEvent (XEvent *);
 
@@ -226,17 +549,41 @@ class EZoomScreen :
 	bool
 	isInMovement (int out);
 
+	float
+	residualMotion (int out);
+
+	void
+	markMoving (int out);
+
+	void
+	planFlight (int out);
+
+	void
+	followFlight (int out);
+
 	void
-	adjustZoomVelocity (int out, float chunk);
+	animateZoomAreas (float ms, float interval);
 
 	void
-	adjustXYVelocity (int out, float chunk);
+	stepMotion (float ms, float interval);
+
+	bool
+	remotePanTimeout ();
+
+	void
+	damagePan ();
+
+	float
+	nextPresentationDelta ();
 
 	void
 	drawBox (const GLMatrix &transform,
 		 CompOutput          *output,
 		 CompRect             box);
 
+	void
+	drawOverlays (CompOutput *output, const GLMatrix &transform);
+
 	void
 	setCenter (int x, int y, bool instant);
 
@@ -253,18 +600,66 @@ class EZoomScreen :
 	void
 	panZoom (int xvalue, int yvalue);
 
+	void
+	panArea (int out, float dx, float dy);
+
+	void
+	continuousPan (float ms);
+
+	void
+	edgePush (float ms);
+
+	bool
+	selectRawMotion (bool on);
+
 	void
 	enableMousePolling ();
 
+	void
+	disableMousePolling ();
+
+	bool
+	mousePolling ();
+
+	bool
+	queryPointer ();
+
+	bool
+	checkIdle ();
+
+	void
+	queueWarp (int x, int y);
+
+	void
+	scheduleWarp ();
+
+	bool
+	flushWarp ();
+
     void
     enableAccessibility ();
 
 	void
 	setScale (int out, float value);
 
+	void
+	queueZoomSteps (float steps);
+
+	void
+	flushZoomInput ();
+
 	void
 	syncCenterToMouse ();
 
+	bool
+	syncWarpTarget (int *x, int *y);
+
+	bool
+	pixelExact (int out);
+
+	void
+	paintedView (int out, float *zoom, float *xTranslate, float *yTranslate);
+
 	void
 	convertToZoomed (int        out,
 			 int        x,
@@ -279,6 +674,139 @@ class EZoomScreen :
 			       int	  *resultX,
 			       int	  *resultY);
 
+	void
+	convertToUnzoomed (int        out,
+			   int        x,
+			   int        y,
+			   int        *resultX,
+			   int        *resultY);
+
+	CompRegion
+	zoomedRegion (int out, const CompRegion &region);
+
+	CompRegion
+	unzoomedRegion (int out, const CompRegion &region);
+
+	void
+	damageZoomedRegion (const CompRegion &region);
+
+	void
+	damageView ();
+
+	void
+	cullWindows (const CompRegion &visible, unsigned int mask);
+
+	bool
+	ensureSceneCache ();
+
+	void
+	freeSceneCache ();
+
+	GLint
+	bindSceneFramebuffer ();
+
+	bool
+	colorFilterActive ();
+
+	bool
+	windowFilterActive ();
+
+	void
+	colorFilterOps (const CompString	  &texelSize,
+			std::vector <CompString> &offsets,
+			std::vector <CompString> &ops);
+
+	GLFragment::FunctionId
+	filterFunction (int target, int param);
+
+	bool
+	enableSceneFilter (float texelX, float texelY);
+
+	void
+	freeColorFilter ();
+
+	void
+	colorFilterChanged (CompOption *opt, Options num);
+
+	bool
+	loadWindowPos ();
+
+	bool
+	softwareMagnify ();
+
+	void
+	paintSoftware (CompOutput     *output,
+		       const CompRect &box,
+		       float	      left,
+		       float	      top,
+		       float	      zoom);
+
+	bool
+	paintFromScene (const GLScreenPaintAttrib &attrib,
+			const GLMatrix		  &transform,
+			const CompRegion	  &region,
+			CompOutput		  *output,
+			unsigned int		  mask);
+
+	bool
+	lensActive (int out);
+
+	CompRect
+	lensRect (int out);
+
+	CompRect
+	lensSource (int out);
+
+	CompRegion
+	lensRegion ();
+
+	void
+	damageLens ();
+
+	void
+	drawLens (CompOutput     *output,
+		  const GLMatrix &transform,
+		  const CompRect &lens,
+		  const CompRect &source);
+
+	bool
+	paintLens (const GLScreenPaintAttrib &attrib,
+		   const GLMatrix	     &transform,
+		   const CompRegion	     &region,
+		   CompOutput		     *output,
+		   unsigned int		     mask);
+
+	bool
+	mirrorActive ();
+
+	bool
+	paintMirror (const GLScreenPaintAttrib &attrib,
+		     const GLMatrix	       &transform,
+		     const CompRegion	       &region,
+		     CompOutput		       *output,
+		     unsigned int	       mask);
+
+	CompRegion
+	mirrorRegion (const CompRegion &region);
+
+	void
+	mirrorView (CompOutput *output,
+		    float      *x1,
+		    float      *y1,
+		    float      *x2,
+		    float      *y2);
+
+	void
+	drawMirror (CompOutput	   *output,
+		    const GLMatrix &transform);
+
+	bool
+	paintZoomedRegion (const GLScreenPaintAttrib &attrib,
+			   const GLMatrix	     &transform,
+			   const CompRegion	     &region,
+			   CompOutput		     *output,
+			   unsigned int		     mask);
+
 	bool
 	ensureVisibility (int x, int y, int margin);
 
@@ -293,9 +821,18 @@ class EZoomScreen :
 	void
 	restrainCursor (int out);
 
+	bool
+	restrainWarpTarget (int out, int *x, int *y);
+
 	void
 	cursorMoved ();
 
+	CompRegion
+	cursorRegion ();
+
+	CompRegion
+	boxRegion ();
+
 	void
 	updateMousePosition (const CompPoint &p);
 
@@ -310,9 +847,21 @@ class EZoomScreen :
 	drawCursor (CompOutput          *output,
 		    const GLMatrix      &transform);
 
+	void
+	setCursor (CursorTexture * cursor, int slot);
+
+	bool
+	cachedCursor (CursorTexture * cursor, unsigned long serial);
+
 	void
 	updateCursor (CursorTexture * cursor);
 
+	void
+	requestCursor (unsigned long serial);
+
+	void
+	collectCursor ();
+
 	void
 	cursorZoomInactive ();
 
@@ -367,7 +916,14 @@ class EZoomScreen :
 		 CompAction::State  state,
 		 CompOption::Vector options,
 		 float		horizAmount,
-		 float		vertAmount);
+		 float		vertAmount,
+		 PanKey		key);
+
+	bool
+	zoomPanTerminate (CompAction         *action,
+			  CompAction::State  state,
+			  CompOption::Vector options,
+			  PanKey	     key);
 
 	bool
 	zoomCenterMouse (CompAction         *action,
@@ -401,8 +957,38 @@ class EZoomScreen :
 #define ZOOM_SCREEN(s)							       \
      EZoomScreen *zs = EZoomScreen::get (s)
 
+/* Here to skip windows that are out of sight while zoomed, and to
+ * color filter the ones we paint zoomed */
+class EZoomWindow :
+    public PluginClassHandler <EZoomWindow, CompWindow>,
+    public GLWindowInterface
+{
+    public:
+
+	EZoomWindow (CompWindow *);
+
+    public:
+
+	CompWindow *window;
+	GLWindow   *gWindow;
+	bool	   culled; // see EZoomScreen::cullWindows
+
+    public:
+
+	bool
+	glPaint (const GLWindowPaintAttrib &,
+		 const GLMatrix		   &,
+		 const CompRegion	   &,
+		 unsigned int);
+
+	void
+	glDrawTexture (GLTexture	  *,
+		       GLFragment::Attrib &,
+		       unsigned int);
+};
+
 class ZoomPluginVTable :
-    public CompPlugin::VTableForScreen <EZoomScreen>
+    public CompPlugin::VTableForScreenAndWindow <EZoomScreen, EZoomWindow>
 {
     public:
 
@@ -0,0 +1,344 @@
+/*
+ * This file is part of the ezoom plugin and is distributed under the
+ * same terms as ezoom.cpp.
+ *
+ * See scaler.h.
+ */
+
+#include "scaler.h"
+
+#include <cmath>
+#include <cstring>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Rows below this are not worth waking the threads for */
+#define SCALER_MIN_THREADED_ROWS 64
+#define SCALER_MAX_THREADS	 8
+/* Bands per thread, so a slow thread does not hold up the frame */
+#define SCALER_BANDS_PER_THREAD	 4
+
+ImageScaler::ImageScaler () :
+    src (NULL),
+    srcWidth (0),
+    srcHeight (0),
+    dst (NULL),
+    dstWidth (0),
+    dstHeight (0),
+    y0 (0.0f),
+    step (1.0f),
+    bilinear (false),
+    started (false),
+    nextBand (0),
+    bands (0),
+    running (0),
+    quit (false)
+{
+    pthread_mutex_init (&mutex, NULL);
+    pthread_cond_init (&wake, NULL);
+    pthread_cond_init (&done, NULL);
+}
+
+/* Only once there is something big enough to scale, so that loading
+ * the plugin with software magnification unused costs no threads.  */
+void
+ImageScaler::startThreads ()
+{
+    long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+
+    started = true;
+
+    if (cpus > SCALER_MAX_THREADS)
+	cpus = SCALER_MAX_THREADS;
+
+    /* The thread calling scale () does its share too */
+    for (long i = 1; i < cpus; i++)
+    {
+	pthread_t thread;
+
+	if (pthread_create (&thread, NULL, &ImageScaler::worker, this))
+	    break;
+	threads.push_back (thread);
+    }
+}
+
+ImageScaler::~ImageScaler ()
+{
+    pthread_mutex_lock (&mutex);
+    quit = true;
+    pthread_cond_broadcast (&wake);
+    pthread_mutex_unlock (&mutex);
+
+    for (unsigned int i = 0; i < threads.size (); i++)
+	pthread_join (threads[i], NULL);
+
+    pthread_cond_destroy (&done);
+    pthread_cond_destroy (&wake);
+    pthread_mutex_destroy (&mutex);
+}
+
+void
+ImageScaler::scale (const uint32_t *src,
+		    int		   srcWidth,
+		    int		   srcHeight,
+		    uint32_t	   *dst,
+		    int		   dstWidth,
+		    int		   dstHeight,
+		    float	   x0,
+		    float	   y0,
+		    float	   step,
+		    bool	   bilinear)
+{
+    if (srcWidth <= 0 || srcHeight <= 0 || dstWidth <= 0 || dstHeight <= 0)
+	return;
+
+    this->src = src;
+    this->srcWidth = srcWidth;
+    this->srcHeight = srcHeight;
+    this->dst = dst;
+    this->dstWidth = dstWidth;
+    this->dstHeight = dstHeight;
+    this->y0 = y0;
+    this->step = step;
+    this->bilinear = bilinear;
+
+    /* The columns are the same for every row */
+    xIndex.resize (dstWidth);
+    xWeight.resize (dstWidth);
+
+    for (int x = 0; x < dstWidth; x++)
+    {
+	float fx = x0 + (x + 0.5f) * step;
+	int   ix, w = 0;
+
+	if (bilinear)
+	{
+	    fx -= 0.5f;
+	    ix = floorf (fx);
+	    w = (fx - ix) * 128.0f + 0.5f;
+	    if (w == 128)
+	    {
+		ix++;
+		w = 0;
+	    }
+	}
+	else
+	{
+	    ix = floorf (fx);
+	}
+
+	if (ix < 0)
+	{
+	    ix = 0;
+	    w = 0;
+	}
+	else if (ix > srcWidth - 1)
+	{
+	    ix = srcWidth - 1;
+	    w = 0;
+	}
+
+	xIndex[x] = ix;
+	xWeight[x] = w;
+    }
+
+    if (dstHeight < SCALER_MIN_THREADED_ROWS)
+    {
+	scaleRows (0, dstHeight, blend);
+	return;
+    }
+
+    if (!started)
+	startThreads ();
+
+    if (threads.empty ())
+	scaleRows (0, dstHeight, blend);
+    else
+	runBands ();
+}
+
+/* Hand the rows out in bands to the threads and to ourselves, and
+ * wait until all are done.  */
+void
+ImageScaler::runBands ()
+{
+    pthread_mutex_lock (&mutex);
+    bands = (threads.size () + 1) * SCALER_BANDS_PER_THREAD;
+    running = bands;
+    nextBand = 0;
+    pthread_cond_broadcast (&wake);
+
+    while (nextBand < bands)
+    {
+	int band = nextBand++;
+
+	pthread_mutex_unlock (&mutex);
+	scaleRows (band * dstHeight / bands, (band + 1) * dstHeight / bands,
+		   blend);
+	pthread_mutex_lock (&mutex);
+
+	running--;
+    }
+
+    while (running)
+	pthread_cond_wait (&done, &mutex);
+    pthread_mutex_unlock (&mutex);
+}
+
+void *
+ImageScaler::worker (void *data)
+{
+    ImageScaler		   *s = (ImageScaler *) data;
+    std::vector <uint32_t> blend;
+
+    pthread_mutex_lock (&s->mutex);
+
+    for (;;)
+    {
+	while (!s->quit && s->nextBand >= s->bands)
+	    pthread_cond_wait (&s->wake, &s->mutex);
+
+	if (s->quit)
+	    break;
+
+	int band = s->nextBand++;
+
+	pthread_mutex_unlock (&s->mutex);
+	s->scaleRows (band * s->dstHeight / s->bands,
+		      (band + 1) * s->dstHeight / s->bands, blend);
+	pthread_mutex_lock (&s->mutex);
+
+	if (--s->running == 0)
+	    pthread_cond_signal (&s->done);
+    }
+
+    pthread_mutex_unlock (&s->mutex);
+
+    return NULL;
+}
+
+/* blend belongs to the calling thread and is kept between calls */
+void
+ImageScaler::scaleRows (int			first,
+			int			last,
+			std::vector <uint32_t> &blend)
+{
+    /* One spare pixel at the end, so x + 1 is always there */
+    if (bilinear && blend.size () < (unsigned int) srcWidth + 1)
+	blend.resize (srcWidth + 1);
+
+    for (int y = first; y < last; y++)
+    {
+	if (bilinear)
+	    bilinearRow (y, &blend[0]);
+	else
+	    nearestRow (y);
+    }
+}
+
+void
+ImageScaler::nearestRow (int y)
+{
+    int		   sy = floorf (y0 + (y + 0.5f) * step);
+    const uint32_t *in;
+    uint32_t	   *out = dst + (dstHeight - 1 - y) * dstWidth;
+
+    sy = sy < 0 ? 0 : (sy > srcHeight - 1 ? srcHeight - 1 : sy);
+    in = src + (srcHeight - 1 - sy) * srcWidth;
+
+    for (int x = 0; x < dstWidth; x++)
+	out[x] = in[xIndex[x]];
+}
+
+/* Blend the two source rows around this row into blend, then blend
+ * horizontally out of that. Weights are out of 128 so that the
+ * products of 16 bit differences stay within 16 bits.  */
+void
+ImageScaler::bilinearRow (int y, uint32_t *blend)
+{
+    float	   fy = y0 + (y + 0.5f) * step - 0.5f;
+    int		   iy = floorf (fy);
+    int		   wy = (fy - iy) * 128.0f + 0.5f;
+    const uint8_t  *top, *bottom;
+    uint8_t	   *mid = (uint8_t *) blend;
+    uint32_t	   *out = dst + (dstHeight - 1 - y) * dstWidth;
+    int		   x = 0;
+
+    if (iy < 0)
+    {
+	iy = 0;
+	wy = 0;
+    }
+    else if (iy >= srcHeight - 1)
+    {
+	iy = srcHeight - 1;
+	wy = 0;
+    }
+
+    top = (const uint8_t *) (src + (srcHeight - 1 - iy) * srcWidth);
+    bottom = top;
+    if (wy)
+	bottom = (const uint8_t *) (src + (srcHeight - 2 - iy) * srcWidth);
+
+    if (!wy)
+    {
+	memcpy (blend, top, srcWidth * sizeof (uint32_t));
+    }
+    else
+    {
+#ifdef __SSE2__
+	__m128i zero = _mm_setzero_si128 ();
+	__m128i weight = _mm_set1_epi16 (wy);
+
+	for (; x + 4 <= srcWidth; x += 4)
+	{
+	    __m128i a = _mm_loadu_si128 ((const __m128i *) (top + x * 4));
+	    __m128i b = _mm_loadu_si128 ((const __m128i *) (bottom + x * 4));
+	    __m128i alo = _mm_unpacklo_epi8 (a, zero);
+	    __m128i ahi = _mm_unpackhi_epi8 (a, zero);
+	    __m128i dlo = _mm_sub_epi16 (_mm_unpacklo_epi8 (b, zero), alo);
+	    __m128i dhi = _mm_sub_epi16 (_mm_unpackhi_epi8 (b, zero), ahi);
+
+	    dlo = _mm_srai_epi16 (_mm_mullo_epi16 (dlo, weight), 7);
+	    dhi = _mm_srai_epi16 (_mm_mullo_epi16 (dhi, weight), 7);
+	    _mm_storeu_si128 ((__m128i *) (mid + x * 4),
+			      _mm_packus_epi16 (_mm_add_epi16 (alo, dlo),
+						_mm_add_epi16 (ahi, dhi)));
+	}
+#endif
+	for (x *= 4; x < srcWidth * 4; x++)
+	    mid[x] = top[x] + (((bottom[x] - top[x]) * wy) >> 7);
+    }
+
+    blend[srcWidth] = blend[srcWidth - 1];
+
+    for (x = 0; x < dstWidth; x++)
+    {
+	const uint8_t *p = mid + xIndex[x] * 4;
+	int	      wx = xWeight[x];
+
+	if (!wx)
+	{
+	    out[x] = blend[xIndex[x]];
+	    continue;
+	}
+
+#ifdef __SSE2__
+	__m128i v = _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i *) p),
+				       _mm_setzero_si128 ());
+	__m128i d = _mm_sub_epi16 (_mm_unpackhi_epi64 (v, v), v);
+
+	d = _mm_srai_epi16 (_mm_mullo_epi16 (d, _mm_set1_epi16 (wx)), 7);
+	out[x] = _mm_cvtsi128_si32 (_mm_packus_epi16 (_mm_add_epi16 (v, d),
+						       v));
+#else
+	uint8_t *o = (uint8_t *) &out[x];
+
+	for (int c = 0; c < 4; c++)
+	    o[c] = p[c] + (((p[c + 4] - p[c]) * wx) >> 7);
+#endif
+    }
+}
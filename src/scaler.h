@@ -0,0 +1,91 @@
+/*
+ * This file is part of the ezoom plugin and is distributed under the
+ * same terms as ezoom.cpp.
+ *
+ * Scales 32 bit images on the CPU, for magnifying when GL is rendered in
+ * software and sampling a texture costs as much as doing it ourselves.
+ * Rows are split in bands over a small pool of threads; the bilinear
+ * kernel uses SSE2 where available.
+ */
+
+#ifndef _EZOOM_SCALER_H
+#define _EZOOM_SCALER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+
+class ImageScaler
+{
+    public:
+
+	ImageScaler ();
+	~ImageScaler ();
+
+    public:
+
+	/* Scale src into dst. Both are packed and stored bottom row first,
+	 * as glReadPixels and glDrawPixels have them. Destination pixel
+	 * (x, y), counted from the top left, samples the source at
+	 * (x0 + (x + 0.5) * step, y0 + (y + 0.5) * step), also counted
+	 * from the top left.  */
+	void
+	scale (const uint32_t *src,
+	       int	      srcWidth,
+	       int	      srcHeight,
+	       uint32_t	      *dst,
+	       int	      dstWidth,
+	       int	      dstHeight,
+	       float	      x0,
+	       float	      y0,
+	       float	      step,
+	       bool	      bilinear);
+
+    private:
+
+	static void *
+	worker (void *data);
+
+	void
+	startThreads ();
+
+	void
+	runBands ();
+
+	void
+	scaleRows (int first, int last, std::vector <uint32_t> &blend);
+
+	void
+	nearestRow (int y);
+
+	void
+	bilinearRow (int y, uint32_t *blend);
+
+    private:
+
+	const uint32_t		*src;
+	int			srcWidth;
+	int			srcHeight;
+	uint32_t		*dst;
+	int			dstWidth;
+	int			dstHeight;
+	float			y0;
+	float			step;
+	bool			bilinear;
+
+	std::vector <int>	xIndex;	/* per destination column */
+	std::vector <int>	xWeight;	/* of the right pixel, of 128 */
+	std::vector <uint32_t>	blend;	/* bilinearRow scratch of scale () */
+
+	std::vector <pthread_t> threads;
+	bool			started;	/* threads tried, if none */
+	pthread_mutex_t		mutex;
+	pthread_cond_t		wake;
+	pthread_cond_t		done;
+	int			nextBand;
+	int			bands;
+	int			running;	/* bands not finished yet */
+	bool			quit;
+};
+
+#endif
@@ -0,0 +1,212 @@
+/*
+ * This file is part of the ezoom plugin and is distributed under the
+ * same terms as ezoom.cpp.
+ *
+ * The spring that animates zoom and pan, kept free of compiz so that it
+ * can be tested on its own.
+ */
+
+#ifndef _EZOOM_SPRING_H
+#define _EZOOM_SPRING_H
+
+#include <cmath>
+#include <vector>
+
+/* The zoom and pan springs.
+ *
+ * One step of the original integrator does
+ *
+ *   v' = (amount * decay * v + 0.15 * (target - p)) / (amount + 1)
+ *   p' = p + v' * chunk / redrawTime
+ *
+ * where amount is the remaining distance (in 1/75ths) clamped to [1, 5].
+ * For a fixed amount this is a linear map on (v, p - target), so n steps
+ * of it can be taken at once by raising the 2x2 step matrix to the n-th
+ * power. Cayley-Hamilton reduces that to M^n = s(n) M - det s(n-1) I, where
+ * s(n) = (l1^n - l2^n) / (l1 - l2) for the eigenvalues l1, l2 of M.
+ *
+ * amount does change as the distance shrinks, so each frame is split into
+ * at most SPRING_SEGMENTS segments and it is re-evaluated for each one.
+ * That keeps the curve on top of the stepped one while the cost stays
+ * constant no matter how many steps a frame is worth.
+ */
+#define SPRING_SEGMENTS 4
+
+static inline double
+springAmount (double distance)
+{
+    double amount = fabs (distance * 75.0);
+
+    if (amount < 1.0)
+	return 1.0;
+    else if (amount > 5.0)
+	return 5.0;
+    return amount;
+}
+
+/* s(n) for a 2x2 matrix with the given trace and determinant */
+static inline double
+springSequence (double trace, double det, int n)
+{
+    double disc;
+
+    if (n <= 0)
+	return 0.0;
+    else if (n == 1)
+	return 1.0;
+
+    disc = trace * trace - 4.0 * det;
+
+    if (disc > 1e-12)
+    {
+	double root = sqrt (disc);
+	double l1 = (trace + root) / 2.0;
+	double l2 = (trace - root) / 2.0;
+
+	return (pow (l1, n) - pow (l2, n)) / root;
+    }
+    else if (disc < -1e-12)
+    {
+	double modulus = sqrt (det);
+	double theta = acos (trace / (2.0 * modulus));
+
+	return pow (modulus, n - 1) * sin (n * theta) / sin (theta);
+    }
+
+    return n * pow (trace / 2.0, n - 1);
+}
+
+/* n steps of the spring for a fixed amount, as the map
+ * (v, e) -> (vv * v + ve * e, ev * v + ee * e) on the velocity and the
+ * distance from the target.  */
+struct SpringMatrix
+{
+    double vv, ve, ev, ee;
+};
+
+static inline void
+springMatrix (double	   amount,
+	      double	   decay,
+	      int	   n,
+	      double	   h,
+	      SpringMatrix &m)
+{
+    double p = amount * decay / (amount + 1.0);
+    double q = 0.15 / (amount + 1.0);
+    double trace = p + 1.0 - h * q;
+    double sn = springSequence (trace, p, n);
+    double sn1 = springSequence (trace, p, n - 1);
+
+    m.vv = p * (sn - sn1);
+    m.ve = -q * sn;
+    m.ev = h * p * sn;
+    m.ee = sn * (1.0 - h * q) - p * sn1;
+}
+
+/* Advance position/velocity towards target by steps steps of size h */
+static inline void
+advanceSpring (float  &position,
+	       float  &velocity,
+	       float  target,
+	       double decay,
+	       int    steps,
+	       double h)
+{
+    int segments = steps < SPRING_SEGMENTS ? steps : SPRING_SEGMENTS;
+
+    while (segments > 0)
+    {
+	int	     n = steps / segments;
+	double	     e = position - target;
+	double	     v = velocity;
+	SpringMatrix m;
+
+	springMatrix (springAmount (e), decay, n, h, m);
+
+	velocity = m.vv * v + m.ve * e;
+	position = target + m.ev * v + m.ee * e;
+
+	steps -= n;
+	segments--;
+    }
+}
+
+/* Per lane matrices for advanceSprings */
+struct SpringCoefficients
+{
+    std::vector <float> vv, ve, ev, ee;
+};
+
+/* advanceSpring for count lanes at once. The matrices are worked out
+ * first, so that the update itself is a plain multiply-add over the
+ * lanes. Lanes far from their target all have the clamped amount and
+ * the zoom and pan lanes alternate, so remembering the last two
+ * matrices saves nearly all of the pow calls.  */
+static inline void
+advanceSprings (float		   *position,
+		float		   *velocity,
+		const float	   *target,
+		const float	   *decay,
+		unsigned int	   count,
+		int		   steps,
+		double		   h,
+		SpringCoefficients &c)
+{
+    int segments = steps < SPRING_SEGMENTS ? steps : SPRING_SEGMENTS;
+
+    if (!count)
+	return;
+
+    c.vv.resize (count);
+    c.ve.resize (count);
+    c.ev.resize (count);
+    c.ee.resize (count);
+
+    while (segments > 0)
+    {
+	int	     n = steps / segments;
+	SpringMatrix cache[2];
+	double	     cacheAmount[2] = { -1.0, -1.0 };
+	float	     cacheDecay[2] = { -1.0f, -1.0f };
+	int	     last = 0;
+	float	     *vv = &c.vv[0], *ve = &c.ve[0];
+	float	     *ev = &c.ev[0], *ee = &c.ee[0];
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+	    double amount = springAmount (position[i] - target[i]);
+	    int    k;
+
+	    for (k = 0; k < 2; k++)
+		if (cacheAmount[k] == amount && cacheDecay[k] == decay[i])
+		    break;
+
+	    if (k == 2)
+	    {
+		k = last = !last;
+		springMatrix (amount, decay[i], n, h, cache[k]);
+		cacheAmount[k] = amount;
+		cacheDecay[k] = decay[i];
+	    }
+
+	    vv[i] = cache[k].vv;
+	    ve[i] = cache[k].ve;
+	    ev[i] = cache[k].ev;
+	    ee[i] = cache[k].ee;
+	}
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+	    float e = position[i] - target[i];
+	    float v = velocity[i];
+
+	    velocity[i] = vv[i] * v + ve[i] * e;
+	    position[i] = target[i] + ev[i] * v + ee[i] * e;
+	}
+
+	steps -= n;
+	segments--;
+    }
+}
+
+#endif
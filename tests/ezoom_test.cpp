@@ -0,0 +1,394 @@
+/*
+ * This file is part of the ezoom plugin and is distributed under the
+ * same terms as ezoom.cpp.
+ *
+ * Checks the parts of ezoom that do not need a running compiz against
+ * straightforward reference versions.
+ */
+
+#include "spring.h"
+#include "cursorpack.h"
+#include "scaler.h"
+
+#include <cstdio>
+#include <cmath>
+#include <vector>
+
+static int failures = 0;
+
+static void
+check (bool ok, const char *what, double got, double want)
+{
+    if (ok)
+	return;
+
+    fprintf (stderr, "FAIL: %s: got %.10g, want %.10g\n", what, got, want);
+    failures++;
+}
+
+/* One step of the spring as ezoom did it before advanceSpring, minus the
+ * snap to the target at the end which the caller still does.  */
+static void
+oldSpringStep (float  &position,
+	       float  &velocity,
+	       float  target,
+	       float  decay,
+	       float  chunk,
+	       float  redrawTime)
+{
+    float d = (target - position) * 75.0f;
+    float adjust = d * 0.002f;
+    float amount = fabs (d);
+
+    if (amount < 1.0f)
+	amount = 1.0f;
+    else if (amount > 5.0f)
+	amount = 5.0f;
+
+    velocity *= decay;
+    velocity = (amount * velocity + adjust) / (amount + 1.0f);
+    position += velocity * chunk / redrawTime;
+}
+
+/* A single step has nothing to approximate */
+static void
+testSingleStep ()
+{
+    static const float starts[] = { -1.0f, -0.03f, 0.0f, 0.004f, 0.5f };
+    static const float decays[] = { 1.0f, 0.8f };
+
+    for (unsigned int i = 0; i < sizeof (starts) / sizeof (starts[0]); i++)
+    {
+	for (unsigned int j = 0; j < 2; j++)
+	{
+	    float p = starts[i], v = 0.01f;
+	    float op = p, ov = v;
+
+	    advanceSpring (p, v, 0.25f, decays[j], 1, 0.7);
+	    oldSpringStep (op, ov, 0.25f, decays[j], 0.7f, 1.0f);
+
+	    check (fabs (p - op) < 1e-6, "single step position", p, op);
+	    check (fabs (v - ov) < 1e-6, "single step velocity", v, ov);
+	}
+    }
+}
+
+/* Whole zoom-ins and pans at the default speed and timestep, with the
+ * frame lengths ezoom is likely to see. The closed form only re-evaluates
+ * the distance dependent damping once per segment, so it may drift from
+ * the stepped curve a little, but it has to arrive at the same time.  */
+static void
+testAnimation ()
+{
+    static const float frames[] = { 6.9f, 16.7f, 33.3f, 100.0f };
+    static const float decays[] = { 1.0f, 0.8f };
+    static const float speed = 25.0f, timestep = 1.2f, redrawTime = 16.7f;
+
+    for (unsigned int i = 0; i < sizeof (frames) / sizeof (frames[0]); i++)
+    {
+	for (unsigned int j = 0; j < 2; j++)
+	{
+	    float  ms = frames[i];
+	    float  amount = ms * 0.05f * speed;
+	    int    steps = amount / (0.5f * timestep);
+	    float  chunk;
+	    float  p = 1.0f, v = 0.0f, op = 1.0f, ov = 0.0f;
+	    float  target = 0.25f;
+	    double worst = 0.0;
+
+	    if (!steps)
+		steps = 1;
+	    chunk = amount / steps;
+
+	    for (int frame = 0; frame < 3000 / ms; frame++)
+	    {
+		advanceSpring (p, v, target, decays[j], steps, chunk / redrawTime);
+
+		for (int s = 0; s < steps; s++)
+		    oldSpringStep (op, ov, target, decays[j], chunk, redrawTime);
+
+		worst = fmax (worst, fabs (p - op));
+	    }
+
+	    /* A quarter percent of the distance travelled */
+	    check (worst < 0.002, "animation drift", worst, 0.002);
+	    check (fabs (p - target) < 1e-3, "animation end", p, target);
+	}
+    }
+}
+
+/* All the lanes at once against one at a time, with zoom and pan lanes
+ * mixed as ezoom lays them out and at every distance regime.  */
+static void
+testSpringLanes ()
+{
+    static const unsigned int count = 3 * 7;
+    float		      p[count], v[count], t[count], d[count];
+    SpringCoefficients	      c;
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+	p[i] = (i % 3 ? 0.5f : 1.0f) - 0.07f * (i / 3);
+	v[i] = 0.002f * ((int) i - 10);
+	t[i] = i % 3 ? 0.1f : 2.0f;
+	d[i] = i % 3 ? 0.8f : 1.0f;
+    }
+
+    for (int frame = 0; frame < 60; frame++)
+    {
+	float op[count], ov[count];
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+	    op[i] = p[i];
+	    ov[i] = v[i];
+	    advanceSpring (op[i], ov[i], t[i], d[i], 34, 0.037);
+	}
+
+	advanceSprings (p, v, t, d, count, 34, 0.037, c);
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+	    check (fabs (p[i] - op[i]) < 1e-5, "lane position", p[i], op[i]);
+	    check (fabs (v[i] - ov[i]) < 1e-5, "lane velocity", v[i], ov[i]);
+	    p[i] = op[i];
+	    v[i] = ov[i];
+	}
+    }
+}
+
+/* The SSE2 row packer against the plain one, for every tail length and
+ * for rows that do not start on a 16 byte boundary. The high half of
+ * each long is junk that has to be dropped.  */
+static void
+testPackCursorRow ()
+{
+    std::vector <unsigned long> in (64 + 4);
+    std::vector <uint32_t>	fast (64 + 4), slow (64 + 4);
+
+    for (unsigned int i = 0; i < in.size (); i++)
+    {
+	in[i] = 0x80402010u * (i + 1);
+	if (sizeof (unsigned long) == 8)
+	    in[i] |= (unsigned long) 0xdeadbeef << 16 << 16;
+    }
+
+    for (int offset = 0; offset < 4; offset++)
+    {
+	for (int width = 0; width <= 64; width++)
+	{
+	    fast.assign (fast.size (), 0xffffffffu);
+	    slow.assign (slow.size (), 0xffffffffu);
+
+	    packCursorRow (&in[offset], &fast[offset], width);
+	    packCursorRowC (&in[offset], &slow[offset], width);
+
+	    for (unsigned int i = 0; i < fast.size (); i++)
+		check (fast[i] == slow[i], "packed cursor row", fast[i],
+		       slow[i]);
+	}
+    }
+}
+
+/* Odd sized images get a transparent border and nothing else */
+static void
+testPackCursorImage ()
+{
+    static const int sizes[][2] = { { 1, 1 }, { 3, 5 }, { 7, 2 }, { 17, 9 } };
+
+    for (unsigned int s = 0; s < sizeof (sizes) / sizeof (sizes[0]); s++)
+    {
+	int			w = sizes[s][0], h = sizes[s][1];
+	std::vector <unsigned long> in (w * h);
+	std::vector <uint32_t>	out ((w + 2) * (h + 2), 0xffffffffu);
+
+	for (unsigned int i = 0; i < in.size (); i++)
+	    in[i] = 0xff000000u | i;
+
+	packCursorImage (&in[0], w, h, &out[0]);
+
+	for (int y = 0; y < h + 2; y++)
+	{
+	    for (int x = 0; x < w + 2; x++)
+	    {
+		uint32_t want = 0;
+
+		if (x > 0 && x <= w && y > 0 && y <= h)
+		    want = in[(y - 1) * w + x - 1];
+
+		check (out[y * (w + 2) + x] == want, "packed cursor image",
+		       out[y * (w + 2) + x], want);
+	    }
+	}
+    }
+}
+
+/* ImageScaler as plainly as it can be written: same sample positions,
+ * same 7 bit weights and the same rounding, one pixel and channel at a
+ * time, with rows counted from the top and the edges repeated.  */
+static uint32_t
+refPixel (const std::vector <uint32_t> &src,
+	  int			       w,
+	  int			       h,
+	  int			       x,
+	  int			       y)
+{
+    x = x < w ? x : w - 1;
+    y = y < h ? y : h - 1;
+
+    return src[(h - 1 - y) * w + x];
+}
+
+static void
+refWeight (float f, int size, bool bilinear, int *i, int *weight)
+{
+    *weight = 0;
+
+    if (bilinear)
+    {
+	f -= 0.5f;
+	*i = floorf (f);
+	*weight = (f - *i) * 128.0f + 0.5f;
+	if (*weight == 128)
+	{
+	    ++*i;
+	    *weight = 0;
+	}
+    }
+    else
+    {
+	*i = floorf (f);
+    }
+
+    if (*i < 0)
+    {
+	*i = 0;
+	*weight = 0;
+    }
+    else if (*i > size - 1)
+    {
+	*i = size - 1;
+	*weight = 0;
+    }
+}
+
+static void
+refScale (const std::vector <uint32_t> &src,
+	  int			       srcWidth,
+	  int			       srcHeight,
+	  std::vector <uint32_t>       &dst,
+	  int			       dstWidth,
+	  int			       dstHeight,
+	  float			       x0,
+	  float			       y0,
+	  float			       step,
+	  bool			       bilinear)
+{
+    for (int y = 0; y < dstHeight; y++)
+    {
+	int iy, wy;
+
+	refWeight (y0 + (y + 0.5f) * step, srcHeight, bilinear, &iy, &wy);
+
+	for (int x = 0; x < dstWidth; x++)
+	{
+	    uint32_t out = 0;
+	    int	     ix, wx;
+
+	    refWeight (x0 + (x + 0.5f) * step, srcWidth, bilinear, &ix, &wx);
+
+	    for (int c = 0; c < 32; c += 8)
+	    {
+		int a = refPixel (src, srcWidth, srcHeight, ix, iy) >> c & 0xff;
+		int b = a, v;
+
+		if (wy)
+		{
+		    b = refPixel (src, srcWidth, srcHeight, ix, iy + 1) >> c &
+			0xff;
+		    a += ((b - a) * wy) >> 7;
+		}
+
+		v = a;
+		if (wx)
+		{
+		    int a1 = refPixel (src, srcWidth, srcHeight,
+				       ix + 1, iy) >> c & 0xff;
+
+		    if (wy)
+		    {
+			b = refPixel (src, srcWidth, srcHeight,
+				      ix + 1, iy + 1) >> c & 0xff;
+			a1 += ((b - a1) * wy) >> 7;
+		    }
+		    v = a + (((a1 - a) * wx) >> 7);
+		}
+
+		out |= (uint32_t) v << c;
+	    }
+
+	    dst[(dstHeight - 1 - y) * dstWidth + x] = out;
+	}
+    }
+}
+
+/* Odd widths leave a tail after the last group of four pixels, and the
+ * views reach past the edges of the source. Tall destinations go
+ * through the threads.  */
+static void
+testScaler ()
+{
+    static const int sizes[][4] = {
+	{ 1, 1, 3, 3 }, { 5, 3, 9, 7 }, { 7, 8, 13, 8 }, { 17, 5, 31, 11 },
+	{ 33, 40, 61, 130 }
+    };
+    static const float views[][3] = {
+	{ 0.0f, 0.0f, 1.0f }, { 0.3f, 0.7f, 0.5f }, { -1.25f, 2.5f, 0.33f },
+	{ 1.5f, -0.75f, 0.125f }, { 0.0f, 0.0f, 1.7f }
+    };
+    ImageScaler scaler;
+
+    for (unsigned int s = 0; s < sizeof (sizes) / sizeof (sizes[0]); s++)
+    {
+	int		       sw = sizes[s][0], sh = sizes[s][1];
+	int		       dw = sizes[s][2], dh = sizes[s][3];
+	std::vector <uint32_t> src (sw * sh);
+	std::vector <uint32_t> got (dw * dh), want (dw * dh);
+
+	for (unsigned int i = 0; i < src.size (); i++)
+	    src[i] = 0x9e3779b9u * (i + 1);
+
+	for (unsigned int v = 0; v < sizeof (views) / sizeof (views[0]); v++)
+	{
+	    for (int bilinear = 0; bilinear < 2; bilinear++)
+	    {
+		got.assign (got.size (), 0xdeadbeefu);
+		scaler.scale (&src[0], sw, sh, &got[0], dw, dh, views[v][0],
+			      views[v][1], views[v][2], bilinear);
+		refScale (src, sw, sh, want, dw, dh, views[v][0],
+			  views[v][1], views[v][2], bilinear);
+
+		for (unsigned int i = 0; i < got.size (); i++)
+		    check (got[i] == want[i], bilinear ? "bilinear scale" :
+			   "nearest scale", got[i], want[i]);
+	    }
+	}
+    }
+}
+
+int
+main ()
+{
+    testSingleStep ();
+    testAnimation ();
+    testSpringLanes ();
+    testPackCursorRow ();
+    testPackCursorImage ();
+    testScaler ();
+
+    if (failures)
+	return 1;
+
+    printf ("all tests passed\n");
+    return 0;
+}